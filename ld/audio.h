@@ -3,11 +3,24 @@
 #include    <iostream>
 #include "filetools.h"
 #include <portaudio.h>
+#include "spsc.h"
+#include "realtime.h"
+#include "rtcheck.h"
+#include "limiter.h"
+#include "dsp.h"
+#include "bufferpool.h"
+#include "pagedbuffer.h"
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <string>
 
 
-typedef std::vector<float> AudioBuffer;
+typedef std::vector<float, PoolAllocator<float>> AudioBuffer; // allocated from bufferPool(), see bufferpool.h
 
 // LightDAW is wav-based, not a single audio library being used when playing audio, we just render into a wav, and play that wav
 // so we need to do a lot of math to mix audio and be able to output it to a wav file
@@ -15,41 +28,22 @@ typedef std::vector<float> AudioBuffer;
 AudioBuffer mixBuffers(const AudioBuffer& buffer1, const AudioBuffer& buffer2, int64_t offset = 0) {
     // if offset is positive, buffer2 is delayed
     // if offset is negative, buffer1 is delayed
-    size_t size;
-    if (offset > 0) {
-        size = std::max(buffer1.size(), buffer2.size() + offset);
-    } else {
-        size = std::max(buffer1.size() - offset, buffer2.size());
-    }
-    AudioBuffer mixedBuffer(size);
-
-    AudioBuffer* a = offset > 0 ? (AudioBuffer*)&buffer2 : (AudioBuffer*)&buffer1;
-    AudioBuffer* b = offset > 0 ? (AudioBuffer*)&buffer1 : (AudioBuffer*)&buffer2;
-
-    for (size_t i = 0; i < size; i++) {
-        if (i < a->size() && i - offset >= 0 && i - offset < b->size()) {
-            mixedBuffer[i] = (*a)[i] + (*b)[i - offset];
-        } else if (i < a->size()) {
-            mixedBuffer[i] = (*a)[i];
-        } else if (i - offset >= 0 && i - offset < b->size()) {
-            mixedBuffer[i] = (*b)[i - offset];
-        }
-    }
-
+    size_t start1 = offset < 0 ? static_cast<size_t>(-offset) : 0;
+    size_t start2 = offset > 0 ? static_cast<size_t>(offset) : 0;
+    AudioBuffer mixedBuffer(std::max(start1 + buffer1.size(), start2 + buffer2.size()));
+    dspMix(mixedBuffer.data() + start1, buffer1.data(), buffer1.size());
+    dspMix(mixedBuffer.data() + start2, buffer2.data(), buffer2.size());
     return mixedBuffer;
 }
 
 void modifyVolume(AudioBuffer& buffer, float volume) { // 0.0f mute, 1.0f no change, 2.0f double volume
-    for (float & i : buffer) {
-        i *= volume;
-    }
+    dspGain(buffer.data(), buffer.size(), volume);
 }
 
-AudioBuffer addToBuffer(AudioBuffer& main, const AudioBuffer& toAdd, size_t offset = 0, float volume = 1.0f) {
-    for (size_t i = 0; i < toAdd.size(); i++) {
-        if (i + offset < main.size()) {
-            main[i + offset] += toAdd[i] * volume;
-        }
+// mixes toAdd into main in place, whatever would go past the end of main is cut off
+AudioBuffer& addToBuffer(AudioBuffer& main, const AudioBuffer& toAdd, size_t offset = 0, float volume = 1.0f) {
+    if (offset < main.size()) {
+        dspMix(main.data() + offset, toAdd.data(), std::min(toAdd.size(), main.size() - offset), volume);
     }
     return main;
 }
@@ -108,217 +102,1119 @@ struct AudioOffset {
     }
 };
 
+struct AudioStream;
+void playtest(const AudioBuffer& buffer); // plays a copy on the preview bus, see the end of this file
+void playtest(const AudioStream& stream);
+
+// the samples are kept in pages (see pagedbuffer.h), writing past the end adds pages instead of copying everything written so far,
+// and the parts of the stream nothing was written to stay unallocated
 struct AudioStream {
-    AudioBuffer buffer{};
+    PagedBuffer buffer{};
 
     AudioStream() = default;
 
+    // when the length is known up front (see NoteTable::duration), the stream starts out that long and silent
+    explicit AudioStream(size_t frames) : buffer(frames) {}
+
     void write(const AudioBuffer& buf, AudioOffset offset = AudioOffset::fromSamples(0)) {
-        if (offset.samples + buf.size() > buffer.size()) {
-            buffer.resize(offset.samples + buf.size());
-        }
-        for (size_t i = 0; i < buf.size(); i++) {
-            // mix the audio
-            buffer[i + offset.samples] += buf[i];
-            // this get's loud very quickly, so we need to normalize it
-            if (buffer[i + offset.samples] > 1.0f) {
-                buffer[i + offset.samples] = 1.0f;
-            } else if (buffer[i + offset.samples] < -1.0f) {
-                buffer[i + offset.samples] = -1.0f;
-            }
-        }
+        // mixed unclamped, the master limiter keeps the sum in range (see limiter.h), so the order of writes doesn't matter
+        buffer.mix(offset.samples, buf.data(), buf.size());
     }
 
     void write(const ByteBuffer& buf, AudioFormat format = AudioFormat::UInt8, AudioOffset offset = AudioOffset::fromSamples(0)) {
-        AudioBuffer convertedBuffer;
+        // converted into scratch memory from this thread's arena, instead of a new buffer for every write
+        RenderArena::Scope scope(renderArena());
+        size_t frames = 0;
+        float* converted = nullptr;
         if (format == AudioFormat::Float32) {
             std::cerr << "Error: AudioStream::write called with Float32 format, but it is a byte buffer" << std::endl;
         } else if (format == AudioFormat::UInt8) {
-            for (size_t i = 0; i < buf.size(); i++) {
-                convertedBuffer.push_back(static_cast<float>(buf[i]) / 128.0f - 1.0f);
+            frames = buf.size();
+            converted = renderArena().allocate<float>(frames);
+            for (size_t i = 0; i < frames; i++) {
+                converted[i] = static_cast<float>(buf[i]) / 128.0f - 1.0f;
             }
         } else if (format == AudioFormat::Int16) {
-            for (size_t i = 0; i < buf.size(); i += 2) {
-                int16_t value = (buf[i] << 8) | buf[i + 1];
-                convertedBuffer.push_back(static_cast<float>(value) / 32768.0f);
+            frames = buf.size() / 2;
+            converted = renderArena().allocate<float>(frames);
+            for (size_t i = 0; i < frames; i++) {
+                int16_t value = (buf[2 * i] << 8) | buf[2 * i + 1];
+                converted[i] = static_cast<float>(value) / 32768.0f;
             }
         } else if (format == AudioFormat::Int32) {
-            for (size_t i = 0; i < buf.size(); i += 4) {
-                int32_t value = (buf[i] << 24) | (buf[i + 1] << 16) | (buf[i + 2] << 8) | buf[i + 3];
-                convertedBuffer.push_back(static_cast<float>(value) / 2147483648.0f);
+            frames = buf.size() / 4;
+            converted = renderArena().allocate<float>(frames);
+            for (size_t i = 0; i < frames; i++) {
+                int32_t value = (buf[4 * i] << 24) | (buf[4 * i + 1] << 16) | (buf[4 * i + 2] << 8) | buf[4 * i + 3];
+                converted[i] = static_cast<float>(value) / 2147483648.0f;
             }
         }
         else {
             std::cerr << "Error: AudioStream::write called with unsupported format" << std::endl;
         }
-        write(convertedBuffer, offset);
+        buffer.mix(offset.samples, converted, frames);
     }
 
+    // only the pages of stream that were written to are mixed in
     void write(const AudioStream& stream, AudioOffset offset = AudioOffset::fromSamples(0)) {
-        write(stream.buffer, offset);
+        if (offset.samples + stream.size() > buffer.size()) {
+            buffer.resize(offset.samples + stream.size());
+        }
+        for (size_t i = 0; i < stream.buffer.pageCount(); i++) {
+            const float* page = stream.buffer.pageData(i);
+            if (page == nullptr) continue;
+            size_t start = i * PAGED_BUFFER_PAGE;
+            buffer.mix(offset.samples + start, page, std::min<size_t>(PAGED_BUFFER_PAGE, stream.size() - start));
+        }
+    }
+
+    // let `fill` add `frames` samples directly into the stream, this saves rendering into a temporary buffer just to copy it in
+    // with write. fill(float* out, size_t frames, size_t done) is called once for every page the samples land in, with how many
+    // of the samples were already done before it
+    template<typename F>
+    void write(size_t frames, AudioOffset offset, F&& fill) {
+        buffer.fill(offset.samples, frames, std::forward<F>(fill));
+    }
+
+    [[nodiscard]] size_t size() const {
+        return buffer.size();
     }
 
     void clear() {
         buffer.clear();
     }
 
-    void playtest() {
-        // play the audio
-        Pa_Initialize();
-        PaStream* stream;
-        Pa_OpenDefaultStream(&stream, 0, 1, paFloat32, SAMPLE_RATE, paFramesPerBufferUnspecified, nullptr, nullptr);
-        Pa_StartStream(stream);
-        Pa_WriteStream(stream, buffer.data(), buffer.size());
-        Pa_StopStream(stream);
-        Pa_CloseStream(stream);
-        Pa_Terminate();
+    // bring the mix under the ceiling, once it is complete
+    // the limiter runs over the pages block by block, its output is LIMITER_LOOKAHEAD samples late so every block is written
+    // back that much earlier than it was read. once the limiter has gone quiet, silent blocks (see silence.h) are skipped
+    // without reading or writing them, so pages that were never written stay unallocated
+    void limit(float ceilingDb = LIMITER_CEILING_DB, float releaseMs = LIMITER_RELEASE_MS) {
+        Limiter limiter(SAMPLE_RATE);
+        limiter.setCeiling(ceilingDb);
+        limiter.setRelease(releaseMs);
+        SilenceMap silence = buffer.silence();
+        float block[SILENCE_BLOCK];
+        size_t quiet = 0; // silent samples the limiter was given in a row, its delay line is silent after LIMITER_LOOKAHEAD
+        size_t length = buffer.size();
+        for (size_t position = 0; position < length + LIMITER_LOOKAHEAD; position += SILENCE_BLOCK) {
+            size_t frames = std::min<size_t>(SILENCE_BLOCK, length + LIMITER_LOOKAHEAD - position);
+            bool silent = silence.isSilent(position, frames);
+            if (silent && quiet >= LIMITER_LOOKAHEAD) {
+                limiter.skipSilence(frames);
+                quiet += frames;
+                continue;
+            }
+            quiet = silent ? quiet + frames : 0;
+            buffer.read(position, block, frames);
+            limiter.process(block, frames);
+            size_t skip = position < LIMITER_LOOKAHEAD ? LIMITER_LOOKAHEAD - position : 0; // the delay line filling up
+            if (skip >= frames) continue;
+            size_t to = position + skip - LIMITER_LOOKAHEAD;
+            buffer.write(to, block + skip, std::min(frames - skip, length - to));
+        }
+    }
+
+    // which blocks of the stream are silent
+    [[nodiscard]] SilenceMap silence(float threshold = SILENCE_THRESHOLD) const {
+        return buffer.silence(threshold);
+    }
+
+    // the whole stream as one buffer
+    [[nodiscard]] AudioBuffer toBuffer() const {
+        AudioBuffer out(buffer.size());
+        buffer.read(0, out.data(), out.size());
+        return out;
+    }
+
+    // play the audio on the preview bus, returns right away
+    void playtest() const {
+        ::playtest(*this);
     }
 };
 
-struct AudioPlayer {
-    struct AudioPlayerData {
-        AudioBuffer buffer;
-        size_t position = 0;
-    } data;
+// a RenderNode is anything the AudioPlayer can pull blocks of audio from while it is playing (see render.h)
+#define RENDER_BLOCK_SIZE 512
+
+struct RenderNode { // abstract class
+    virtual ~RenderNode() = default;
+
+    // mix `frames` samples of this node, starting at timeline sample `position`, into `out`
+    // the caller is responsible for clearing `out` before the first node is rendered into it
+    virtual void render(float* out, size_t position, size_t frames) = 0;
+
+    // length of the node in samples, playback stops once the position passes the end
+    [[nodiscard]] virtual size_t length() const = 0;
+};
+
+#define SCOPE_SIZE 4096
+#define TRANSPORT_QUEUE_SIZE 64
+#define RENDER_AHEAD_BLOCKS 16 // default lookahead of a render player, about 190 ms
+#define RENDER_AHEAD_MAX_BLOCKS 64 // the most the lookahead can be set to
+
+// what the ui asks the audio thread to do, see AudioPlayer
+struct TransportCommand {
+    enum Type {
+        Seek, // go to position
+        Play,
+        Pause,
+        Stop, // pause and go back to the start
+        Loop, // loop [position, loopEnd), a loopEnd of 0 turns looping off
+        SwapBuffer // play buffer from now on, the old one is handed back to the ui thread to be freed
+    } type = Seek;
+    size_t position = 0;
+    size_t loopEnd = 0;
+    AudioBuffer* buffer = nullptr;
+};
+
+#define CALLBACK_HISTOGRAM_BINS 32 // callback time in steps of 1/16 of the buffer period, the last bin also counts everything slower
+
+// how long the callback takes compared to how long it has (the time the device takes to play the buffer it fills),
+// and what PortAudio reported through statusFlags. only the audio thread writes it, with relaxed atomics, so reading it
+// from the ui never blocks the callback. counts of a read can be a callback apart from each other, that's fine for stats
+struct CallbackTiming {
+    std::atomic<uint64_t> callbacks{0};
+    std::atomic<uint64_t> late{0}; // took longer than the buffer period
+    std::atomic<uint64_t> inputUnderflows{0};
+    std::atomic<uint64_t> inputOverflows{0};
+    std::atomic<uint64_t> outputUnderflows{0}; // the device ran out of samples, an audible xrun
+    std::atomic<uint64_t> outputOverflows{0};
+    std::atomic<uint64_t> lastNanos{0};
+    std::atomic<uint64_t> maxNanos{0};
+    std::atomic<uint64_t> totalNanos{0};
+    std::atomic<uint64_t> periodNanos{0}; // of the last callback
+    std::atomic<unsigned long> frames{0}; // of the last callback
+    std::atomic<uint64_t> histogram[CALLBACK_HISTOGRAM_BINS];
+
+    CallbackTiming() {
+        for (auto& bin : histogram) {
+            bin.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // audio thread
+    void record(uint64_t nanos, unsigned long bufferFrames, PaStreamCallbackFlags statusFlags) {
+        uint64_t period = static_cast<uint64_t>(bufferFrames) * 1000000000ull / SAMPLE_RATE;
+        callbacks.fetch_add(1, std::memory_order_relaxed);
+        if (nanos > period) late.fetch_add(1, std::memory_order_relaxed);
+        if (statusFlags & paInputUnderflow) inputUnderflows.fetch_add(1, std::memory_order_relaxed);
+        if (statusFlags & paInputOverflow) inputOverflows.fetch_add(1, std::memory_order_relaxed);
+        if (statusFlags & paOutputUnderflow) outputUnderflows.fetch_add(1, std::memory_order_relaxed);
+        if (statusFlags & paOutputOverflow) outputOverflows.fetch_add(1, std::memory_order_relaxed);
+        lastNanos.store(nanos, std::memory_order_relaxed);
+        if (nanos > maxNanos.load(std::memory_order_relaxed)) maxNanos.store(nanos, std::memory_order_relaxed);
+        totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+        periodNanos.store(period, std::memory_order_relaxed);
+        frames.store(bufferFrames, std::memory_order_relaxed);
+        size_t bin = period > 0 ? static_cast<size_t>(nanos * 16 / period) : CALLBACK_HISTOGRAM_BINS - 1;
+        histogram[std::min<size_t>(bin, CALLBACK_HISTOGRAM_BINS - 1)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // ui thread, a callback that runs at the same time can have part of its numbers cleared and part not
+    void reset() {
+        for (auto* counter : {&callbacks, &late, &inputUnderflows, &inputOverflows, &outputUnderflows, &outputOverflows, &maxNanos, &totalNanos}) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+        for (auto& bin : histogram) {
+            bin.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // fraction of the buffer period the last callback used
+    [[nodiscard]] double load() const {
+        uint64_t period = periodNanos.load(std::memory_order_relaxed);
+        return period > 0 ? static_cast<double>(lastNanos.load(std::memory_order_relaxed)) / period : 0.0;
+    }
+
+    [[nodiscard]] double averageNanos() const {
+        uint64_t count = callbacks.load(std::memory_order_relaxed);
+        return count > 0 ? static_cast<double>(totalNanos.load(std::memory_order_relaxed)) / count : 0.0;
+    }
+};
+
+#define AUDIO_MAX_SOURCES 32 // players (and anything else) that can play through the output at once
+#define AUDIO_CHUNK_SIZE 1024 // the output mixes its sources in pieces of at most this many frames
+
+// how the output stream is opened. the defaults are what Pa_OpenDefaultStream does.
+// lowLatency() is for monitoring (playing notes while editing), safe() trades latency for headroom on slow or busy machines
+struct AudioSettings {
+    enum Mode {
+        Default,
+        LowLatency,
+        Safe
+    } mode = Default;
+    PaDeviceIndex device = paNoDevice; // paNoDevice is the default output device
+    unsigned long framesPerBuffer = paFramesPerBufferUnspecified; // let the host pick
+    double suggestedLatency = 0; // seconds, 0 is the device's default, its low latency or its high latency for Safe
+    double sampleRate = SAMPLE_RATE;
+    bool realtime = false; // set up the audio and render threads and lock the engine's memory, see realtime.h
+
+    static AudioSettings lowLatency() {
+        AudioSettings settings;
+        settings.mode = LowLatency;
+        settings.framesPerBuffer = 128;
+        return settings;
+    }
+
+    static AudioSettings safe() {
+        AudioSettings settings;
+        settings.mode = Safe;
+        settings.framesPerBuffer = 2048;
+        return settings;
+    }
+
+    // so every deployment can pick its own without a rebuild:
+    // LD_AUDIO_MODE=low|safe, LD_AUDIO_DEVICE=<index>, LD_AUDIO_BUFFER=<frames>, LD_AUDIO_LATENCY=<seconds>, LD_AUDIO_REALTIME=1
+    static AudioSettings fromEnvironment() {
+        AudioSettings settings;
+        if (const char* mode = std::getenv("LD_AUDIO_MODE")) {
+            std::string name = mode;
+            if (name == "low") {
+                settings = lowLatency();
+            } else if (name == "safe") {
+                settings = safe();
+            } else if (name != "default") {
+                std::cerr << "Error: Unknown LD_AUDIO_MODE " << name << ", expected low, safe or default" << std::endl;
+            }
+        }
+        if (const char* device = std::getenv("LD_AUDIO_DEVICE")) {
+            settings.device = std::atoi(device);
+        }
+        if (const char* frames = std::getenv("LD_AUDIO_BUFFER")) {
+            settings.framesPerBuffer = std::strtoul(frames, nullptr, 10);
+        }
+        if (const char* latency = std::getenv("LD_AUDIO_LATENCY")) {
+            settings.suggestedLatency = std::atof(latency);
+        }
+        if (const char* realtime = std::getenv("LD_AUDIO_REALTIME")) {
+            settings.realtime = std::string(realtime) == "1";
+        }
+        return settings;
+    }
+};
+
+// anything the output can play, an AudioPlayer for example
+struct OutputSource {
+    virtual ~OutputSource() = default;
 
-    PaStream* stream{};
+    // audio thread, write `frames` (at most AUDIO_CHUNK_SIZE) samples into out, the output mixes them with the other sources
+    virtual void process(float* out, unsigned long frames) = 0;
+
+    // ui thread, lock and prefault what process uses (see prepareMemory) when the output is in real time mode, and undo it again.
+    // only called while the source is on the output and nothing but the callback uses that memory
+    virtual void lockRealtimeMemory() {}
+    virtual void unlockRealtimeMemory() {}
+};
+
+// the one stream everything plays through. sources are added and removed by the ui thread while the callback runs,
+// they are kept in a fixed array of atomic pointers so the callback never has to wait for the ui to add or remove one
+struct AudioOutput {
+    PaStream* stream = nullptr;
+    AudioSettings settings;
+    std::atomic<OutputSource*> sources[AUDIO_MAX_SOURCES];
+    std::atomic<uint64_t> callbacksDone{0};
+    CallbackTiming timing;
+    float chunk[AUDIO_CHUNK_SIZE]{}; // audio thread only
+    bool setupThread = false; // real time mode, the callback still has to set up its thread
+    Limiter limiter{SAMPLE_RATE}; // audio thread only, the master
+    std::atomic<float> limiterCeiling{LIMITER_CEILING_DB}; // dB, set by the ui, picked up by the next callback
+    std::atomic<float> limiterRelease{LIMITER_RELEASE_MS};
+    std::atomic<float> limiterReduction{1.0f}; // the lowest gain of the last callback
+    float appliedCeiling = LIMITER_CEILING_DB; // audio thread, what limiter was set to
+    float appliedRelease = LIMITER_RELEASE_MS;
+    bool memoryLocked = false;
+
+    AudioOutput() {
+        for (auto& source : sources) {
+            source.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    AudioOutput(const AudioOutput&) = delete;
+    AudioOutput& operator=(const AudioOutput&) = delete;
 
     static int callback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
-        auto* data = (AudioPlayerData*)userData;
-        if (data->position >= data->buffer.size()) {
-            return paComplete;
+        auto* output = (AudioOutput*)userData;
+        if (output->setupThread) {
+            setupAudioThread(); // once per stream, PortAudio gives every stream its own thread
+            output->setupThread = false;
         }
+        RealtimeScope scope("audio callback");
+        auto started = std::chrono::steady_clock::now();
         float* out = (float*)outputBuffer;
-        for (unsigned long i = 0; i < framesPerBuffer; i++) {
-            if (data->position < data->buffer.size()) {
-                *out++ = data->buffer[data->position++];
-            } else {
-                *out++ = 0.0f;
+        std::fill(out, out + framesPerBuffer, 0.0f);
+        for (unsigned long i = 0; i < framesPerBuffer; i += AUDIO_CHUNK_SIZE) {
+            unsigned long frames = std::min<unsigned long>(AUDIO_CHUNK_SIZE, framesPerBuffer - i);
+            for (auto& slot : output->sources) {
+                OutputSource* source = slot.load(std::memory_order_acquire);
+                if (source == nullptr) continue;
+                source->process(output->chunk, frames);
+                for (unsigned long j = 0; j < frames; j++) {
+                    out[i + j] += output->chunk[j];
+                }
             }
         }
+        float ceiling = output->limiterCeiling.load(std::memory_order_relaxed);
+        float release = output->limiterRelease.load(std::memory_order_relaxed);
+        if (ceiling != output->appliedCeiling) {
+            output->limiter.setCeiling(ceiling);
+            output->appliedCeiling = ceiling;
+        }
+        if (release != output->appliedRelease) {
+            output->limiter.setRelease(release);
+            output->appliedRelease = release;
+        }
+        output->limiter.process(out, framesPerBuffer);
+        output->limiterReduction.store(output->limiter.reduction, std::memory_order_relaxed);
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+        output->timing.record(static_cast<uint64_t>(nanos), framesPerBuffer, statusFlags);
+        output->callbacksDone.fetch_add(1);
         return paContinue;
     }
 
-    AudioPlayer() {
-        PaError e = Pa_OpenDefaultStream(&stream, 0, 1, paFloat32, SAMPLE_RATE, paFramesPerBufferUnspecified, callback, &data);
+    [[nodiscard]] bool isOpen() const {
+        return stream != nullptr;
+    }
+
+    // (re)open and start the stream, the sources keep playing through the new one. false if it failed, there is no stream then
+    bool open(const AudioSettings& newSettings) {
+        close();
+        settings = newSettings;
+        if (settings.sampleRate != SAMPLE_RATE) {
+            // everything is rendered at SAMPLE_RATE, a stream at another rate would play it at the wrong pitch
+            std::cerr << "Error: Sample rate " << settings.sampleRate << " isn't supported, using " << SAMPLE_RATE << std::endl;
+            settings.sampleRate = SAMPLE_RATE;
+        }
+        PaStreamParameters parameters{};
+        parameters.device = settings.device != paNoDevice ? settings.device : Pa_GetDefaultOutputDevice();
+        const PaDeviceInfo* info = parameters.device != paNoDevice ? Pa_GetDeviceInfo(parameters.device) : nullptr;
+        if (info == nullptr || info->maxOutputChannels < 1) {
+            std::cerr << "Error: No audio output device" << std::endl;
+            return false;
+        }
+        parameters.channelCount = 1;
+        parameters.sampleFormat = paFloat32;
+        parameters.suggestedLatency = settings.suggestedLatency > 0 ? settings.suggestedLatency
+                : settings.mode == AudioSettings::Safe ? info->defaultHighOutputLatency : info->defaultLowOutputLatency;
+        parameters.hostApiSpecificStreamInfo = nullptr;
+        PaError e = Pa_OpenStream(&stream, nullptr, &parameters, settings.sampleRate, settings.framesPerBuffer, paNoFlag, callback, this);
         if (e != paNoError) {
             std::cerr << "Error: PortAudio failed to open stream" << std::endl;
-            return;
+            std::cerr << Pa_GetErrorText(e) << std::endl;
+            stream = nullptr;
+            return false;
         }
+        timing.reset();
+        setRealtime(settings.realtime);
+        e = Pa_StartStream(stream);
+        if (e != paNoError) {
+            std::cerr << "Error: PortAudio failed to start stream" << std::endl;
+            std::cerr << Pa_GetErrorText(e) << std::endl;
+            close();
+            return false;
+        }
+        return true;
     }
 
-    explicit AudioPlayer(const AudioBuffer& buffer) : AudioPlayer() {
-        data.buffer = buffer;
+    void close() {
+        if (stream == nullptr) return;
+        Pa_CloseStream(stream); // stops it first, the callback is done once this returns
+        stream = nullptr;
     }
 
-    ~AudioPlayer() {
-        Pa_CloseStream(stream);
+    // ui thread, false if every slot is taken
+    bool add(OutputSource* source) {
+        if (memoryLocked) {
+            source->lockRealtimeMemory();
+        }
+        for (auto& slot : sources) {
+            OutputSource* empty = nullptr;
+            if (slot.compare_exchange_strong(empty, source)) return true;
+        }
+        if (memoryLocked) {
+            source->unlockRealtimeMemory();
+        }
+        std::cerr << "Error: Too many audio sources, the limit is " << AUDIO_MAX_SOURCES << std::endl;
+        return false;
     }
 
-    void play() {
-        // prevent errors
-        if (data.buffer.empty()) {
-            std::cerr << "Error: AudioPlayer::play called with empty buffer" << std::endl;
-            return;
+    // ui thread, once this returns the callback doesn't use source anymore and it can be deleted
+    void remove(OutputSource* source) {
+        for (auto& slot : sources) {
+            OutputSource* expected = source;
+            slot.compare_exchange_strong(expected, nullptr);
         }
-        // make sure there is no corruption in the buffer
-        if (data.position >= data.buffer.size()) {
-            data.position = 0;
+        // a callback that started before the slot was cleared can still be using it, wait for it to end
+        uint64_t done = callbacksDone.load();
+        while (stream != nullptr && Pa_IsStreamActive(stream) == 1 && callbacksDone.load() == done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-        // if already playing, do nothing
-        PaError active = Pa_IsStreamActive(stream);
-        if (active == 1) {
-            return;
+        if (memoryLocked) {
+            source->unlockRealtimeMemory();
         }
-        PaError e = Pa_StartStream(stream);
-        if (e != paNoError) {
-            std::cerr << "Error: PortAudio failed to start stream" << std::endl;
-            std::cerr << Pa_GetErrorText(e) << std::endl;
-            return;
+    }
+
+    // ui thread, the master limiter's ceiling in dBFS and its release in milliseconds
+    void setLimiter(float ceilingDb, float releaseMs) {
+        limiterCeiling.store(ceilingDb, std::memory_order_relaxed);
+        limiterRelease.store(releaseMs, std::memory_order_relaxed);
+    }
+
+    // what the stream really got, in seconds. the input is 0, the stream only has an output
+    [[nodiscard]] double inputLatency() const {
+        const PaStreamInfo* info = stream != nullptr ? Pa_GetStreamInfo(stream) : nullptr;
+        return info != nullptr ? info->inputLatency : 0.0;
+    }
+
+    [[nodiscard]] double outputLatency() const {
+        const PaStreamInfo* info = stream != nullptr ? Pa_GetStreamInfo(stream) : nullptr;
+        return info != nullptr ? info->outputLatency : 0.0;
+    }
+
+    // input to output, what someone playing along hears
+    [[nodiscard]] double latency() const {
+        return inputLatency() + outputLatency();
+    }
+
+    [[nodiscard]] double sampleRate() const {
+        const PaStreamInfo* info = stream != nullptr ? Pa_GetStreamInfo(stream) : nullptr;
+        return info != nullptr ? info->sampleRate : 0.0;
+    }
+
+    // the stream isn't running, so nothing else touches the memory.
+    // real time mode locks all of the process's memory if the system allows it (see lockAllMemory), the sources still lock and
+    // prefault their own memory, which is all that stays locked when it doesn't. realtimeStatus() tells which one it was
+    void setRealtime(bool enabled) {
+        setupThread = enabled;
+        if (enabled == memoryLocked) return;
+        memoryLocked = enabled;
+        if (enabled) {
+            lockAllMemory();
+            prepareMemory(this, sizeof(*this));
+        } else {
+            unlockMemory(this, sizeof(*this));
+        }
+        for (auto& slot : sources) {
+            OutputSource* source = slot.load();
+            if (source == nullptr) continue;
+            if (enabled) {
+                source->lockRealtimeMemory();
+            } else {
+                source->unlockRealtimeMemory();
+            }
+        }
+        if (!enabled) {
+            unlockAllMemory();
         }
     }
 
-    void pause() const {
-        PaError stopped = Pa_IsStreamStopped(stream);
-        if (stopped == 1) {
-            return;
+    // the devices that can play, index and name
+    static std::vector<std::pair<PaDeviceIndex, std::string>> devices() {
+        std::vector<std::pair<PaDeviceIndex, std::string>> result;
+        for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++) {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+            if (info != nullptr && info->maxOutputChannels > 0) {
+                result.emplace_back(i, info->name);
+            }
         }
-        PaError e = Pa_StopStream(stream);
-        if (e != paNoError) {
-            std::cerr << "Error: PortAudio failed to stop stream" << std::endl;
-            std::cerr << Pa_GetErrorText(e) << std::endl;
-            return;
+        return result;
+    }
+};
+
+inline AudioOutput& audioOutput() {
+    static AudioOutput output;
+    return output;
+}
+
+#define PREVIEW_VOICES 16 // previews that sound at once, a new one takes the voice of the one that started first
+#define PREVIEW_SLOTS (2 * PREVIEW_VOICES) // the voices, and previews that are waiting for the next callback, a power of two
+#define PREVIEW_FRAMES SAMPLE_RATE // what every slot holds from the start, a second (a key press on the piano)
+
+// auditioning notes and sounds (clicking a piano key, playtest) without a player per note: the bus is always on the output.
+// a preview is played for its whole length. every slot owns a buffer that is allocated once, the ui renders (or copies) the
+// preview into a free slot and hands the slot to the callback through a wait-free queue, the callback hands it back once it
+// has played to the end, or once its voice was taken by a newer preview. a slot only ever belongs to one of the two threads.
+// a buffer only grows (on the ui thread) when a preview is longer than anything the slot played before, so pressing keys
+// doesn't allocate, and the callback never waits, allocates or frees
+struct PreviewBus : public OutputSource {
+    struct PreviewVoice {
+        AudioBuffer samples; // whoever owns the slot, at least `length` samples
+        size_t length = 0;
+        size_t position = 0;
+        uint64_t started = 0; // audio thread, to find the oldest preview
+    };
+
+    PreviewVoice voices[PREVIEW_SLOTS];
+    SpscQueue<size_t, PREVIEW_SLOTS> triggers; // ui -> audio, slots to start
+    SpscQueue<size_t, PREVIEW_SLOTS> finished; // audio -> ui, slots that can be used again
+    std::vector<size_t> available; // ui thread, never grows past PREVIEW_SLOTS
+    size_t playing[PREVIEW_VOICES]{}; // audio thread
+    size_t playingCount = 0; // audio thread
+    uint64_t starts = 0; // audio thread
+    bool memoryLocked = false; // ui thread
+
+    PreviewBus() {
+        available.reserve(PREVIEW_SLOTS);
+        for (size_t i = 0; i < PREVIEW_SLOTS; i++) {
+            voices[i].samples.resize(PREVIEW_FRAMES);
+            available.push_back(i);
         }
     }
 
-    void resume() const {
-        PaError stopped = Pa_IsStreamStopped(stream);
-        if (stopped == 0) {
-            return;
+    PreviewBus(const PreviewBus&) = delete;
+    PreviewBus& operator=(const PreviewBus&) = delete;
+
+    // the slots, queues and the buffers of the slots, a buffer that grows is locked again in trigger
+    void lockRealtimeMemory() override {
+        memoryLocked = true;
+        prepareMemory(this, sizeof(*this));
+        for (PreviewVoice& voice : voices) {
+            prepareMemory(voice.samples.data(), voice.samples.size() * sizeof(float));
         }
-        PaError e = Pa_StartStream(stream);
-        if (e != paNoError) {
-            std::cerr << "Error: PortAudio failed to start stream" << std::endl;
-            std::cerr << Pa_GetErrorText(e) << std::endl;
-            return;
+    }
+
+    void unlockRealtimeMemory() override {
+        memoryLocked = false;
+        unlockMemory(this, sizeof(*this));
+        for (PreviewVoice& voice : voices) {
+            unlockMemory(voice.samples.data(), voice.samples.size() * sizeof(float));
         }
     }
 
-    void stop() {
-        PaError stopped = Pa_IsStreamStopped(stream);
-        if (stopped == 1) {
-            data.position = 0;
-            return;
+    void process(float* out, unsigned long frames) override {
+        size_t slot;
+        while (triggers.pop(slot)) {
+            if (playingCount == PREVIEW_VOICES) {
+                size_t oldest = 0;
+                for (size_t i = 1; i < playingCount; i++) {
+                    if (voices[playing[i]].started < voices[playing[oldest]].started) oldest = i;
+                }
+                finished.push(playing[oldest]); // can't fail, there are only PREVIEW_SLOTS slots
+                playing[oldest] = playing[--playingCount];
+            }
+            voices[slot].started = starts++;
+            playing[playingCount++] = slot;
         }
-        PaError e = Pa_AbortStream(stream);
-        data.position = 0;
-        if (e != paNoError) {
-            std::cerr << "Error: PortAudio failed to stop stream" << std::endl;
-            std::cerr << Pa_GetErrorText(e) << std::endl;
+        std::fill(out, out + frames, 0.0f);
+        for (size_t i = 0; i < playingCount;) {
+            PreviewVoice& preview = voices[playing[i]];
+            size_t n = std::min<size_t>(frames, preview.length - preview.position);
+            for (size_t j = 0; j < n; j++) {
+                out[j] += preview.samples[preview.position + j];
+            }
+            preview.position += n;
+            if (preview.position >= preview.length) {
+                finished.push(playing[i]);
+                playing[i] = playing[--playingCount];
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // ui thread, render(float* out) writes `frames` samples of the preview into out, which is cleared first.
+    // false only when more than PREVIEW_SLOTS previews are started before the callback runs again
+    template<typename F>
+    bool trigger(size_t frames, F&& render) {
+        size_t slot;
+        while (finished.pop(slot)) {
+            available.push_back(slot);
+        }
+        if (available.empty()) return false;
+        slot = available.back();
+        available.pop_back();
+        PreviewVoice& preview = voices[slot];
+        if (preview.samples.size() < frames) {
+            // the first preview this long, the slot keeps the space
+            if (memoryLocked) unlockMemory(preview.samples.data(), preview.samples.size() * sizeof(float));
+            preview.samples.resize(frames);
+            if (memoryLocked) prepareMemory(preview.samples.data(), preview.samples.size() * sizeof(float));
+        }
+        std::fill(preview.samples.begin(), preview.samples.begin() + static_cast<std::ptrdiff_t>(frames), 0.0f);
+        render(preview.samples.data());
+        preview.length = frames;
+        preview.position = 0;
+        triggers.push(slot); // can't fail either
+        return true;
+    }
+
+    // ui thread, plays a copy of the samples
+    bool play(const float* samples, size_t frames) {
+        return trigger(frames, [&](float* out) {
+            std::copy_n(samples, frames, out);
+        });
+    }
+};
+
+inline PreviewBus& previewBus() {
+    static PreviewBus bus;
+    return bus;
+}
+
+// a block the render worker made ahead of the playhead
+struct RenderBlock {
+    uint64_t generation = 0; // blocks of an older generation were rendered for a position that was seeked away from
+    size_t position = 0;
+    size_t frames = 0;
+    float samples[RENDER_BLOCK_SIZE];
+};
+
+// where the render worker has to (re)start, sent by the callback whenever the position or the loop changes
+struct RenderRestart {
+    uint64_t generation = 0;
+    size_t position = 0;
+    size_t loopStart = 0;
+    size_t loopEnd = 0;
+};
+
+// the ui thread never touches what the audio thread is using: every change (seek, play, ...) is a TransportCommand
+// that goes through a wait-free queue, and the callback applies them at the start of the next block.
+// the callback publishes the position and whether it is playing back through atomics.
+// the stream keeps running from the first play until the player is deleted, paused or stopped it just outputs silence.
+// a player that streams from a RenderNode never renders in the callback: a worker thread renders blocks up to
+// `lookahead` blocks ahead of the playhead into a wait-free ring, and the callback only copies them out.
+// a block that takes long to render eats into the lookahead instead of making the device miss a buffer
+struct AudioPlayer {
+    // everything that isn't atomic belongs to the audio thread once the stream is started
+    struct AudioPlayerData : public OutputSource {
+        AudioBuffer* buffer = nullptr; // owned
+        RenderNode* source = nullptr; // if set, blocks are rendered from this instead of being read from buffer
+        size_t position = 0;
+        bool playing = false;
+        size_t loopStart = 0;
+        size_t loopEnd = 0; // looping when loopEnd > loopStart
+
+        SpscQueue<TransportCommand, TRANSPORT_QUEUE_SIZE> commands; // ui -> audio
+        SpscQueue<AudioBuffer*, TRANSPORT_QUEUE_SIZE> retired; // audio -> ui, buffers that were swapped out, freeing them isn't real time safe
+        std::atomic<size_t> publishedPosition{0};
+        std::atomic<bool> publishedPlaying{false};
+        std::atomic<uint64_t> applied{0}; // how many commands were handled, updated after the position and playing
+
+        // render ahead, only used when there is a source
+        SpscQueue<RenderBlock, RENDER_AHEAD_MAX_BLOCKS> ahead; // worker -> audio
+        SpscQueue<RenderRestart, TRANSPORT_QUEUE_SIZE> restarts; // audio -> worker
+        uint64_t generation = 0; // of the blocks the callback wants
+        size_t blockOffset = 0; // how much of the block at the front of ahead was played
+        bool restart = false; // the position or the loop changed, the blocks that were rendered ahead are of no use
+        bool primed = false; // a block was played since the last restart, the gap right after a seek isn't an underrun
+        std::atomic<size_t> lookahead{RENDER_AHEAD_BLOCKS};
+        std::atomic<size_t> sourceLength{0}; // source->length() as the worker last saw it
+        std::atomic<uint64_t> underruns{0}; // callbacks that ran out of rendered blocks while playing
+        std::atomic<bool> quit{false};
+        bool realtime = false; // the output was in real time mode when the player was made, see AudioPlayer()
+
+        // the last samples that were sent to the device, used to draw the waveform
+        std::atomic<float> scope[SCOPE_SIZE];
+        std::atomic<size_t> scopePosition{0};
+
+        AudioPlayerData() {
+            for (auto& sample : scope) {
+                sample.store(0.0f, std::memory_order_relaxed);
+            }
+        }
+
+        [[nodiscard]] size_t length() const {
+            if (source != nullptr) return sourceLength.load(std::memory_order_acquire);
+            return buffer != nullptr ? buffer->size() : 0;
+        }
+
+        void apply(const TransportCommand& command) {
+            switch (command.type) {
+                case TransportCommand::Seek:
+                    position = command.position;
+                    restart = true;
+                    break;
+                case TransportCommand::Play:
+                    if (position >= length()) {
+                        position = 0;
+                        restart = true;
+                    }
+                    playing = true;
+                    break;
+                case TransportCommand::Pause:
+                    playing = false;
+                    break;
+                case TransportCommand::Stop:
+                    playing = false;
+                    position = 0;
+                    restart = true;
+                    break;
+                case TransportCommand::Loop:
+                    loopStart = command.position;
+                    loopEnd = command.loopEnd;
+                    restart = true;
+                    break;
+                case TransportCommand::SwapBuffer:
+                    // this push can't fail, the ui empties retired every time it sends a command, and both queues are the same size
+                    if (buffer != nullptr) {
+                        retired.push(buffer);
+                    }
+                    buffer = command.buffer;
+                    break;
+            }
+        }
+
+        void publish() {
+            publishedPosition.store(position, std::memory_order_release);
+            publishedPlaying.store(playing, std::memory_order_release);
+        }
+
+        // audio thread, tell the worker where to render from after a seek or a loop change.
+        // if it is too far behind to take the restart, this is tried again on the next callback
+        void sendRestart() {
+            if (restart && restarts.push({generation + 1, position, loopStart, loopEnd})) {
+                generation++;
+                restart = false;
+                primed = false;
+                blockOffset = 0;
+            }
+        }
+
+        // audio thread, copy rendered blocks into out, returns how many frames were copied
+        size_t readAhead(float* out, size_t frames) {
+            if (restart) return 0; // every block that was rendered is stale
+            size_t copied = 0;
+            while (copied < frames) {
+                RenderBlock* block = ahead.peek();
+                if (block == nullptr) break;
+                if (block->generation != generation) {
+                    ahead.drop();
+                    continue;
+                }
+                size_t n = std::min(block->frames - blockOffset, frames - copied);
+                std::copy_n(block->samples + blockOffset, n, out + copied);
+                blockOffset += n;
+                copied += n;
+                position = block->position + blockOffset; // the worker already wrapped around the loop
+                primed = true;
+                if (blockOffset == block->frames) {
+                    ahead.drop();
+                    blockOffset = 0;
+                }
+            }
+            return copied;
+        }
+
+        void process(float* out, unsigned long framesPerBuffer) override {
+            TransportCommand command;
+            uint64_t done = 0;
+            while (commands.pop(command)) {
+                apply(command);
+                done++;
+            }
+            if (done > 0) {
+                publish();
+                applied.fetch_add(done, std::memory_order_release);
+            }
+
+            std::fill(out, out + framesPerBuffer, 0.0f);
+            size_t total = length();
+            unsigned long i = 0;
+            if (source != nullptr) {
+                sendRestart();
+                if (playing) {
+                    i = readAhead(out, framesPerBuffer);
+                }
+                if (playing && i < framesPerBuffer) {
+                    bool looping = loopEnd > loopStart && loopEnd <= total;
+                    if (!looping && position >= total) {
+                        playing = false; // reached the end
+                    } else if (primed) {
+                        underruns.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+            while (playing && source == nullptr && i < framesPerBuffer) {
+                bool looping = loopEnd > loopStart && loopEnd <= total;
+                if (looping && (position >= loopEnd || position < loopStart)) {
+                    position = loopStart;
+                }
+                size_t end = looping ? loopEnd : total;
+                if (position >= end) {
+                    playing = false; // reached the end
+                    break;
+                }
+                size_t frames = std::min<size_t>({RENDER_BLOCK_SIZE, framesPerBuffer - i, end - position});
+                std::copy_n(buffer->data() + position, frames, out + i);
+                position += frames;
+                i += frames;
+            }
+            publish();
+
+            size_t scopeAt = scopePosition.load(std::memory_order_relaxed);
+            for (unsigned long j = 0; j < framesPerBuffer; j++) {
+                scope[scopeAt].store(out[j], std::memory_order_relaxed);
+                scopeAt = (scopeAt + 1) % SCOPE_SIZE;
+            }
+            scopePosition.store(scopeAt, std::memory_order_release);
+        }
+
+        // the render worker, keeps ahead filled with the blocks that come after the playhead until quit
+        void renderAhead() {
+            if (realtime) {
+                setupRenderThread();
+            }
+            uint64_t workerGeneration = 0;
+            size_t workerPosition = 0;
+            size_t workerLoopStart = 0;
+            size_t workerLoopEnd = 0;
+            uint64_t reported = 0;
+            while (!quit.load(std::memory_order_acquire)) {
+                RenderRestart request;
+                while (restarts.pop(request)) {
+                    workerGeneration = request.generation;
+                    workerPosition = request.position;
+                    workerLoopStart = request.loopStart;
+                    workerLoopEnd = request.loopEnd;
+                }
+                size_t length = source->length();
+                sourceLength.store(length, std::memory_order_release);
+
+                uint64_t missed = underruns.load(std::memory_order_relaxed);
+                if (missed > reported) {
+                    std::cerr << "Warning: AudioPlayer render worker fell behind, " << missed - reported << " underrun(s)" << std::endl;
+                    reported = missed;
+                }
+
+                // same rule as for buffers in callback
+                bool looping = workerLoopEnd > workerLoopStart && workerLoopEnd <= length;
+                if (looping && (workerPosition >= workerLoopEnd || workerPosition < workerLoopStart)) {
+                    workerPosition = workerLoopStart;
+                }
+                size_t end = looping ? workerLoopEnd : length;
+                RenderBlock* block = ahead.size() < lookahead.load(std::memory_order_relaxed) ? ahead.reserve() : nullptr;
+                if (block == nullptr || workerPosition >= end) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    continue;
+                }
+                block->generation = workerGeneration;
+                block->position = workerPosition;
+                block->frames = std::min<size_t>(RENDER_BLOCK_SIZE, end - workerPosition);
+                std::fill_n(block->samples, block->frames, 0.0f);
+                {
+                    RealtimeScope scope("render worker");
+                    source->render(block->samples, workerPosition, block->frames);
+                }
+                ahead.commit();
+                workerPosition += block->frames;
+            }
+        }
+    } data;
+
+    // the ui side, what the player will be doing once every command that was sent is applied
+    uint64_t sent = 0;
+    bool expectedPlaying = false;
+    size_t expectedPosition = 0;
+    size_t bufferLength = 0;
+    std::thread worker;
+
+
+    // every player plays through audioOutput(), it is added to it once it is set up
+    AudioPlayer() {
+        lockMemory();
+        audioOutput().add(&data);
+    }
+
+    explicit AudioPlayer(const AudioBuffer& buffer) {
+        data.buffer = new AudioBuffer(buffer);
+        bufferLength = buffer.size();
+        lockMemory();
+        audioOutput().add(&data);
+    }
+
+    // stream from a render graph instead of a pre-rendered buffer, the source must outlive the player.
+    // lookahead is how many blocks are rendered ahead of the playhead, more absorbs bigger spikes but edits take longer to be heard
+    explicit AudioPlayer(RenderNode* source, size_t lookahead = RENDER_AHEAD_BLOCKS) {
+        data.source = source;
+        data.sourceLength.store(source->length(), std::memory_order_release);
+        setLookahead(lookahead);
+        lockMemory();
+        worker = std::thread(&AudioPlayerData::renderAhead, &data);
+        audioOutput().add(&data);
+    }
+
+    // the output holds a pointer to data
+    AudioPlayer(const AudioPlayer&) = delete;
+    AudioPlayer& operator=(const AudioPlayer&) = delete;
+
+    ~AudioPlayer() {
+        audioOutput().remove(&data);
+        if (worker.joinable()) {
+            data.quit.store(true, std::memory_order_release);
+            worker.join();
+        }
+        freeRetired();
+        if (data.realtime) {
+            unlockMemory(&data, sizeof(data));
+            if (data.buffer != nullptr) unlockMemory(data.buffer->data(), data.buffer->size() * sizeof(float));
+        }
+        delete data.buffer;
+    }
+
+    void play() {
+        // prevent errors
+        if (length() == 0) {
+            std::cerr << "Error: AudioPlayer::play called with empty buffer" << std::endl;
             return;
         }
+        if (!send({TransportCommand::Play})) return;
+        if (expectedPosition >= length()) {
+            expectedPosition = 0;
+        }
+        expectedPlaying = true;
+        startStream();
+    }
+
+    void pause() {
+        if (!send({TransportCommand::Pause})) return;
+        expectedPlaying = false;
+    }
 
+    void resume() {
+        if (!send({TransportCommand::Play})) return;
+        expectedPlaying = true;
+        startStream();
+    }
+
+    void stop() {
+        if (!send({TransportCommand::Stop})) return;
+        expectedPlaying = false;
+        expectedPosition = 0;
+    }
+
+    // loop [start, end) (in samples) until the loop is cleared, playback jumps to start once it reaches end
+    void setLoop(size_t start, size_t end) {
+        send({TransportCommand::Loop, start, end});
+    }
+
+    void clearLoop() {
+        send({TransportCommand::Loop, 0, 0});
+    }
+
+    // replace what a buffer player is playing without stopping it
+    void swapBuffer(AudioBuffer buffer) {
+        size_t size = buffer.size();
+        auto* swapped = new AudioBuffer(std::move(buffer));
+        if (!send({TransportCommand::SwapBuffer, 0, 0, swapped})) {
+            delete swapped;
+            return;
+        }
+        bufferLength = size;
     }
 
     [[nodiscard]] bool isPlaying() const {
-        return Pa_IsStreamActive(stream) == 1;
+        return pending() ? expectedPlaying : data.publishedPlaying.load(std::memory_order_acquire);
     }
 
+    [[nodiscard]] size_t length() const {
+        return data.source != nullptr ? data.source->length() : bufferLength;
+    }
+
+    [[nodiscard]] size_t position() const {
+        return pending() ? expectedPosition : data.publishedPosition.load(std::memory_order_acquire);
+    }
+
+    // 0 when there is nothing to play (an empty project or pattern)
     float progress() const {
-        return static_cast<float>(data.position) / data.buffer.size();
+        size_t len = length();
+        return len > 0 ? static_cast<float>(position()) / static_cast<float>(len) : 0.0f;
     }
 
     void seek(float progress) {
-        data.position = static_cast<size_t>(progress * data.buffer.size());
+        size_t target = static_cast<size_t>(progress * length());
+        if (send({TransportCommand::Seek, target})) {
+            expectedPosition = target;
+        }
     }
 
-    const AudioBuffer& getBuffer() const {
-        return data.buffer;
+    // sample that was played `ago` samples before the most recent one (ago < SCOPE_SIZE)
+    float getRecentSample(size_t ago) const {
+        size_t scopePosition = data.scopePosition.load(std::memory_order_acquire);
+        return data.scope[(scopePosition + SCOPE_SIZE - 1 - ago) % SCOPE_SIZE].load(std::memory_order_relaxed);
     }
 
     size_t getPosition() const {
-        return data.position;
+        return position();
     }
 
-};
+    // in blocks of RENDER_BLOCK_SIZE, clamped to [1, RENDER_AHEAD_MAX_BLOCKS]. takes effect as the worker catches up
+    void setLookahead(size_t blocks) {
+        data.lookahead.store(std::clamp<size_t>(blocks, 1, RENDER_AHEAD_MAX_BLOCKS), std::memory_order_relaxed);
+    }
 
-void initAudio() {
-    Pa_Initialize();
-}
+    [[nodiscard]] size_t lookahead() const {
+        return data.lookahead.load(std::memory_order_relaxed);
+    }
 
-void terminateAudio() {
-    Pa_Terminate();
-}
+    // how many callbacks found no rendered audio while playing and played silence instead
+    [[nodiscard]] uint64_t underruns() const {
+        return data.underruns.load(std::memory_order_relaxed);
+    }
 
-std::vector<AudioPlayer> __audioPlaytestPlayers;
+private:
+    // are there commands the callback hasn't applied yet
+    [[nodiscard]] bool pending() const {
+        return data.applied.load(std::memory_order_acquire) < sent;
+    }
 
+    bool send(const TransportCommand& command) {
+        freeRetired();
+        if (!pending()) {
+            expectedPosition = data.publishedPosition.load(std::memory_order_acquire);
+        }
+        if (!data.commands.push(command)) {
+            std::cerr << "Error: AudioPlayer command queue is full" << std::endl;
+            return false;
+        }
+        sent++;
+        return true;
+    }
+
+    void freeRetired() {
+        AudioBuffer* buffer;
+        while (data.retired.pop(buffer)) {
+            delete buffer;
+        }
+    }
+
+    // in real time mode, the player locks its own memory before its render worker starts (after that the worker writes to it),
+    // so it is locked for the output's mode when the player was made. buffers that are swapped in later are only locked when
+    // the output could lock everything (see AudioOutput::setRealtime)
+    void lockMemory() {
+        data.realtime = audioOutput().settings.realtime;
+        if (!data.realtime) return;
+        prepareMemory(&data, sizeof(data));
+        if (data.buffer != nullptr) prepareMemory(data.buffer->data(), data.buffer->size() * sizeof(float));
+    }
+
+    // the output normally runs from initAudio to terminateAudio, this only does something if opening it failed or it was closed
+    void startStream() {
+        if (!audioOutput().isOpen()) {
+            audioOutput().open(audioOutput().settings);
+        }
+    }
+};
+
+// plays the whole buffer on the preview bus
 void playtest(const AudioBuffer& buffer) {
-    __audioPlaytestPlayers.erase(std::remove_if(__audioPlaytestPlayers.begin(), __audioPlaytestPlayers.end(), [](const AudioPlayer& player) {
-        return !player.isPlaying();
-    }), __audioPlaytestPlayers.end());
+    previewBus().play(buffer.data(), buffer.size());
+}
 
-    __audioPlaytestPlayers.emplace_back(buffer);
-    __audioPlaytestPlayers.back().play();
+// straight from the pages into the preview slot, without a buffer in between
+void playtest(const AudioStream& stream) {
+    previewBus().trigger(stream.size(), [&](float* out) {
+        stream.buffer.read(0, out, stream.size());
+    });
 }
 
+void initAudio(const AudioSettings& settings = AudioSettings::fromEnvironment()) {
+    Pa_Initialize();
+    audioOutput().add(&previewBus());
+    audioOutput().open(settings);
+}
 
+// delete every player before this
+void terminateAudio() {
+    audioOutput().close();
+    audioOutput().remove(&previewBus());
+    Pa_Terminate();
+}
@@ -0,0 +1,619 @@
+#pragma once
+
+#include "project.h"
+#include "rendercache.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// C++17 basic LightDaw batch rendering
+// re-rendering a lot of projects at once (after an instrument changed) is a list of RenderJobs, usually read from a manifest
+// by ldrender --batch. several jobs run at the same time, but their stems all render on one shared pool (one thread per core),
+// so a batch never runs more render threads than there are cores, however many jobs are running.
+// a job first works out how much memory it can take at most and waits until that fits into the batch's MemoryBudget,
+// so a batch of long songs doesn't run out of memory by starting all of them at once.
+// what is shared between the jobs is only ever read: the wavetables (see wavetable.h) are built once for the whole process,
+// and rendered stems go into a RenderCache owned by the batch, so a project that is rendered by several jobs
+// (the mix, the stems, a range) only renders every pair once, those jobs run one after the other.
+// every job is reported with its timings and memory, see writeBatchReport
+
+#define BATCH_MEMORY_BUDGET (2048ull * 1024 * 1024) // bytes for every running job together
+#define BATCH_CACHE_SHARE 4 // a quarter of the budget goes to the stem cache
+
+// one render of a batch, the same things the ldrender command line takes
+struct RenderJob {
+    std::string project; // .ldpa
+    std::string output; // .wav, with stems the files are named after it (see stemFileName)
+    AudioFormat format = AudioFormat::Int16;
+    bool stems = false; // a wav per pair instead of the mix
+    OfflineRenderOptions options; // options.threads isn't used, the batch has its own pool
+    size_t line = 0; // in the manifest, 0 when the job came from the command line
+};
+
+struct RenderJobResult {
+    enum class Status {
+        Ok,
+        Errors, // rendered, but something was left out (a missing midi, an instrument that isn't a synth)
+        Failed, // nothing (or not everything) was written
+    };
+
+    Status status = Status::Failed;
+    std::vector<std::string> errors;
+    std::vector<std::string> files; // written
+    OfflineRenderStats stats;
+    double queuedSeconds = 0; // from the start of the batch until the job started
+    double loadSeconds = 0;
+    double waitSeconds = 0; // for the memory budget
+    double writeSeconds = 0;
+    double totalSeconds = 0; // from when the job started until it was done
+    size_t estimatedBytes = 0; // what the job asked the budget for
+    size_t peakBytes = 0; // the most the job's own buffers took up at once
+
+    [[nodiscard]] const char* statusName() const {
+        switch (status) {
+            case Status::Ok:
+                return "ok";
+            case Status::Errors:
+                return "errors";
+            default:
+                return "failed";
+        }
+    }
+};
+
+// a number of bytes that jobs take from and give back, when a job doesn't fit it waits until enough was given back.
+// a job that is larger than the whole budget still runs, but only when nothing else is running
+struct MemoryBudget {
+    size_t budget;
+    size_t used = 0;
+    size_t peak = 0;
+    size_t waits = 0; // how many jobs had to wait
+    std::mutex mutex;
+    std::condition_variable released;
+
+    explicit MemoryBudget(size_t budget) : budget(budget) {}
+
+    void acquire(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto fits = [&] { return used == 0 || used + bytes <= budget; };
+        if (!fits()) {
+            waits++;
+            released.wait(lock, fits);
+        }
+        used += bytes;
+        peak = std::max(peak, used);
+    }
+
+    void release(size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used -= bytes;
+        }
+        released.notify_all();
+    }
+
+    // acquires on construction and releases when it goes out of scope, also when a render throws
+    struct Lease {
+        MemoryBudget& budget;
+        size_t bytes;
+
+        Lease(MemoryBudget& budget, size_t bytes) : budget(budget), bytes(bytes) {
+            budget.acquire(bytes);
+        }
+
+        ~Lease() {
+            budget.release(bytes);
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+    };
+};
+
+struct BatchSettings {
+    size_t threads = std::thread::hardware_concurrency(); // of the shared stem pool
+    size_t jobs = std::thread::hardware_concurrency(); // running at the same time
+    size_t memoryBudget = BATCH_MEMORY_BUDGET;
+};
+
+struct BatchResult {
+    std::vector<RenderJobResult> jobs; // in the order of the manifest
+    size_t threads = 0;
+    size_t concurrentJobs = 0;
+    size_t memoryBudget = 0;
+    size_t budgetPeak = 0; // most of the budget that was taken at once
+    size_t budgetWaits = 0;
+    size_t cacheBudget = 0;
+    size_t cacheHits = 0;
+    size_t cacheMisses = 0;
+    BufferPoolStats pool; // for the whole process, when the batch was done
+    double seconds = 0;
+
+    [[nodiscard]] size_t count(RenderJobResult::Status status) const {
+        return static_cast<size_t>(std::count_if(jobs.begin(), jobs.end(), [status](const RenderJobResult& job) {
+            return job.status == status;
+        }));
+    }
+};
+
+inline size_t bytesPerSample(AudioFormat format) {
+    return format == AudioFormat::UInt8 ? 1 : format == AudioFormat::Int16 ? 2 : 4;
+}
+
+// the stems of a job are named after its output, song.wav turns into song.1-bass.wav, song.2-lead.wav, ... in pair order
+inline std::string stemFileName(const std::string& output, size_t index, const std::string& instrument) {
+    size_t slash = output.find_last_of("/\\");
+    size_t dot = output.find_last_of('.');
+    bool extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    std::string name = std::to_string(index + 1);
+    if (!instrument.empty()) {
+        name += '-';
+        for (char c: instrument) {
+            name += std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' ? c : '_';
+        }
+    }
+    return extension ? output.substr(0, dot) + "." + name + output.substr(dot) : output + "." + name + ".wav";
+}
+
+// the most memory rendering the pairs can take: every stem as if none of its pages were silent, the mix,
+// and the copies made while writing a wav (a float buffer, the converted samples and the file's bytes).
+// stems that are already in the cache are taken from it now and kept in `pinned` (by pair, nullptr for the ones that have to
+// be rendered), another job can push them out of the cache before this one renders, then they would have to be rendered again.
+// they count with what they really take up, once evicted they are only in this job's part of the budget
+inline size_t estimateJobBytes(ProjectData& data, const std::vector<std::pair<uint64_t, uint64_t>>& pairs, const RenderJob& job, RenderCache* cache, std::vector<Stem>& pinned) {
+    auto clip = [&](size_t length) {
+        size_t end = std::min(length, job.options.to);
+        return end > job.options.from ? end - job.options.from : 0;
+    };
+    size_t stems = 0;
+    size_t longest = 0;
+    pinned.assign(pairs.size(), nullptr);
+    for (size_t i = 0; i < pairs.size(); i++) {
+        const auto &[midi, instrument] = pairs[i];
+        Instrument &real = *data.realInstruments.at(instrument);
+        size_t length = clip(stemLength(&real, *data.midis.at(midi).notes));
+        longest = std::max(longest, length);
+        if (cache != nullptr) {
+            pinned[i] = cache->find(ProjectData::stemKey(midi, instrument, real));
+            if (pinned[i] != nullptr) {
+                stems += pinned[i]->bytes();
+                continue;
+            }
+        }
+        size_t pages = (length + PAGED_BUFFER_PAGE - 1) / PAGED_BUFFER_PAGE;
+        stems += pages * PAGED_BUFFER_PAGE * sizeof(float) + (length + SILENCE_BLOCK - 1) / SILENCE_BLOCK;
+    }
+    size_t mix = (longest + PAGED_BUFFER_PAGE - 1) / PAGED_BUFFER_PAGE * PAGED_BUFFER_PAGE * sizeof(float);
+    size_t wav = longest * (sizeof(float) + 3 * bytesPerSample(job.format));
+    return stems + mix + wav;
+}
+
+// writes the stream as a wav, returns the bytes it took to do that (the stream not included)
+inline size_t writeStream(const AudioStream& stream, const RenderJob& job, const std::string& file, RenderJobResult& result) {
+    if (WavFile(stream.toBuffer(), job.format, SAMPLE_RATE).saveToFile(file)) {
+        result.files.push_back(file);
+    } else {
+        result.errors.push_back("Failed to write " + file);
+        result.status = RenderJobResult::Status::Failed;
+    }
+    return stream.size() * (sizeof(float) + 3 * bytesPerSample(job.format));
+}
+
+// loads the project, waits for the budget, renders and writes the wav(s). the stems render on `pool`, the rest on this thread.
+// never throws, whatever goes wrong (a damaged project, running out of memory on a long song) fails the job
+inline RenderJobResult runRenderJob(const RenderJob& job, ThreadPool& pool, MemoryBudget& budget, RenderCache* cache = nullptr) {
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    };
+    RenderJobResult result;
+    ProjectData data;
+    Clock::time_point start = Clock::now();
+    bool loading = true;
+    auto fail = [&](const std::string& error) {
+        std::cerr << "Error: " << error << std::endl;
+        result.status = RenderJobResult::Status::Failed;
+        result.errors.insert(result.errors.begin(), data.error_queue.begin(), data.error_queue.end());
+        result.errors.push_back(error);
+        result.totalSeconds = seconds(start, Clock::now());
+        if (loading) result.loadSeconds = result.totalSeconds;
+        return result;
+    };
+
+    ByteBuffer bytes = loadFile(job.project);
+    if (bytes.empty()) {
+        return fail("Failed to load project: " + job.project);
+    }
+    try {
+        data.load(ArchiveFile::fromBytes(bytes));
+    } catch (const std::exception& e) {
+        return fail(std::string("Failed to load project: ") + e.what());
+    }
+    if (job.options.pattern != PROJECT_ALL_PATTERNS && job.options.pattern >= data.patterns.size()) {
+        return fail("Selected pattern out of bounds");
+    }
+
+    try {
+        std::vector<std::pair<uint64_t, uint64_t>> pairs = data.renderPairs(job.options.pattern);
+        Clock::time_point loaded = Clock::now();
+        result.loadSeconds = seconds(start, loaded);
+        loading = false;
+
+        std::vector<Stem> pinned;
+        result.estimatedBytes = estimateJobBytes(data, pairs, job, cache, pinned);
+        MemoryBudget::Lease lease(budget, result.estimatedBytes);
+        Clock::time_point admitted = Clock::now();
+        result.waitSeconds = seconds(loaded, admitted);
+        result.status = RenderJobResult::Status::Ok;
+
+        if (job.stems) {
+            // every stem goes through the limiter on its own, like a pair that is played alone
+            std::vector<OfflineStem> stems = renderOfflineStems(data, pairs, job.options, result.stats, pool, cache, pinned);
+            result.stats.renderSeconds = seconds(admitted, Clock::now());
+            size_t frames = offlineLength(stems, job.options); // every stem file is as long as the mix, so they line up
+            for (size_t i = 0; i < stems.size(); i++) {
+                Clock::time_point begin = Clock::now();
+                AudioStream stream = mixOffline({stems[i]}, job.options, frames);
+                Clock::time_point mixed = Clock::now();
+                stream.limit(job.options.ceilingDb, job.options.releaseMs);
+                Clock::time_point limited = Clock::now();
+                result.stats.mixPages += stream.buffer.allocatedPages();
+                result.stats.peak = std::max(result.stats.peak, streamPeak(stream));
+                size_t written = writeStream(stream, job, stemFileName(job.output, i, data.instruments[pairs[i].second].name), result);
+                result.peakBytes = std::max(result.peakBytes, result.stats.stemBytes + stream.buffer.allocatedPages() * PAGED_BUFFER_PAGE * sizeof(float) + written);
+                result.stats.mixSeconds += seconds(begin, mixed);
+                result.stats.limitSeconds += seconds(mixed, limited);
+                result.writeSeconds += seconds(limited, Clock::now());
+            }
+            result.stats.frames = frames;
+        } else {
+            AudioStream stream = renderOffline(data, pairs, job.options, result.stats, pool, cache, pinned);
+            Clock::time_point mixed = Clock::now();
+            size_t mixBytes = stream.buffer.allocatedPages() * PAGED_BUFFER_PAGE * sizeof(float);
+            size_t written = writeStream(stream, job, job.output, result);
+            result.peakBytes = std::max(result.stats.stemBytes + mixBytes, mixBytes + written);
+            result.writeSeconds = seconds(mixed, Clock::now());
+        }
+    } catch (const std::exception& e) {
+        return fail(std::string("Failed to render: ") + e.what());
+    }
+
+    if (result.status == RenderJobResult::Status::Ok && !data.error_queue.empty()) {
+        result.status = RenderJobResult::Status::Errors;
+    }
+    result.errors.insert(result.errors.begin(), data.error_queue.begin(), data.error_queue.end());
+    result.totalSeconds = seconds(start, Clock::now());
+    return result;
+}
+
+// runs every job, settings.jobs at a time, and returns their results in the same order.
+// done(index, finished, result) is called after every job with how many jobs are finished so far, for progress.
+// it is called from the job's thread, but never for two jobs at the same time
+template<typename F>
+BatchResult runBatch(const std::vector<RenderJob>& jobs, const BatchSettings& settings, F&& done) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    BatchResult batch;
+    batch.jobs.resize(jobs.size());
+    batch.threads = std::max<size_t>(settings.threads, 1);
+    batch.concurrentJobs = std::max<size_t>(std::min(settings.jobs, jobs.size()), 1);
+    batch.cacheBudget = settings.memoryBudget / BATCH_CACHE_SHARE;
+    batch.memoryBudget = settings.memoryBudget - batch.cacheBudget;
+
+    ThreadPool pool(batch.threads);
+    MemoryBudget budget(batch.memoryBudget);
+    RenderCache cache;
+    cache.setBudget(batch.cacheBudget);
+    RenderCache* shared = jobs.size() > 1 ? &cache : nullptr; // a single job has nobody to share its stems with
+    std::mutex mutex; // for started, busy, completed and done
+    std::condition_variable finished; // a job is done, a project might not be busy anymore
+    std::vector<bool> started(jobs.size(), false);
+    std::unordered_set<std::string> busy; // projects a runner is rendering right now
+    size_t remaining = jobs.size(); // not started yet
+    size_t completed = 0;
+    {
+        // the jobs run on their own threads, never on the pool: they wait for their stems, which need the pool's threads.
+        // two jobs of the same project never run at the same time, the second one would render every stem again
+        // instead of finding it in the cache. a runner takes the first job whose project isn't busy
+        std::vector<std::thread> runners;
+        for (size_t r = 0; r < batch.concurrentJobs; r++) {
+            runners.emplace_back([&] {
+                while (true) {
+                    size_t index = jobs.size();
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        finished.wait(lock, [&] {
+                            if (remaining == 0) return true;
+                            for (size_t i = 0; i < jobs.size(); i++) {
+                                if (!started[i] && busy.count(jobs[i].project) == 0) {
+                                    index = i;
+                                    return true;
+                                }
+                            }
+                            return false;
+                        });
+                        if (index == jobs.size()) return;
+                        started[index] = true;
+                        remaining--;
+                        busy.insert(jobs[index].project);
+                    }
+                    double queued = std::chrono::duration<double>(Clock::now() - start).count();
+                    RenderJobResult result = runRenderJob(jobs[index], pool, budget, shared);
+                    result.queuedSeconds = queued;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        batch.jobs[index] = std::move(result);
+                        busy.erase(jobs[index].project);
+                        done(index, ++completed, batch.jobs[index]);
+                    }
+                    finished.notify_all();
+                }
+            });
+        }
+        for (std::thread& runner: runners) {
+            runner.join();
+        }
+    }
+    batch.budgetPeak = budget.peak;
+    batch.budgetWaits = budget.waits;
+    batch.cacheHits = cache.hits;
+    batch.cacheMisses = cache.misses;
+    cache.clear();
+    batch.pool = bufferPool().snapshot();
+    batch.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return batch;
+}
+
+// just enough JSON for the report: objects, arrays, strings and numbers, commas are put in by itself
+struct JsonWriter {
+    std::ostream& out;
+    std::vector<bool> first; // one per open object or array, whether nothing was written into it yet
+    size_t indent = 2;
+
+    explicit JsonWriter(std::ostream& out) : out(out) {}
+
+    void beginObject() {
+        open('{');
+    }
+
+    void endObject() {
+        close('}');
+    }
+
+    void beginArray() {
+        open('[');
+    }
+
+    void endArray() {
+        close(']');
+    }
+
+    // the name of the next value in an object
+    void key(const std::string& name) {
+        separate();
+        string(name);
+        out << ": ";
+        named = true;
+    }
+
+    void value(const std::string& text) {
+        separate();
+        string(text);
+    }
+
+    void value(const char* text) {
+        value(std::string(text));
+    }
+
+    void value(double number) {
+        separate();
+        if (std::isfinite(number)) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.6g", number);
+            out << buffer;
+        } else {
+            out << "null"; // json has no infinity or nan
+        }
+    }
+
+    void value(size_t number) {
+        separate();
+        out << number;
+    }
+
+    void value(bool b) {
+        separate();
+        out << (b ? "true" : "false");
+    }
+
+    void null() {
+        separate();
+        out << "null";
+    }
+
+    template<typename T>
+    void field(const std::string& name, const T& v) {
+        key(name);
+        value(v);
+    }
+
+private:
+    bool named = false; // a key was just written, the value goes on the same line
+
+    void open(char bracket) {
+        separate();
+        out << bracket;
+        first.push_back(true);
+    }
+
+    void close(char bracket) {
+        bool empty = first.back();
+        first.pop_back();
+        if (!empty) newline();
+        out << bracket;
+        if (first.empty()) out << '\n';
+    }
+
+    void separate() {
+        if (named) {
+            named = false;
+            return;
+        }
+        if (first.empty()) return;
+        if (!first.back()) out << ',';
+        first.back() = false;
+        newline();
+    }
+
+    void newline() {
+        out << '\n' << std::string(first.size() * indent, ' ');
+    }
+
+    void string(const std::string& text) {
+        out << '"';
+        for (char c: text) {
+            switch (c) {
+                case '"':
+                    out << "\\\"";
+                    break;
+                case '\\':
+                    out << "\\\\";
+                    break;
+                case '\n':
+                    out << "\\n";
+                    break;
+                case '\t':
+                    out << "\\t";
+                    break;
+                case '\r':
+                    out << "\\r";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buffer[8];
+                        std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                        out << buffer;
+                    } else {
+                        out << c;
+                    }
+            }
+        }
+        out << '"';
+    }
+};
+
+// the report of a batch as json, one object per job (in manifest order) and a summary.
+// times are in seconds, sizes in bytes, peak in dBFS (null for silence)
+inline void writeBatchReport(std::ostream& out, const std::vector<RenderJob>& jobs, const BatchResult& batch) {
+    JsonWriter json(out);
+    json.beginObject();
+    json.key("jobs");
+    json.beginArray();
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const RenderJob& job = jobs[i];
+        const RenderJobResult& result = batch.jobs[i];
+        const OfflineRenderStats& stats = result.stats;
+        json.beginObject();
+        json.field("index", i);
+        json.field("line", job.line);
+        json.field("project", job.project);
+        json.field("output", job.output);
+        json.field("mode", job.stems ? "stems" : "mix");
+        json.key("pattern");
+        if (job.options.pattern == PROJECT_ALL_PATTERNS) {
+            json.null();
+        } else {
+            json.value(job.options.pattern);
+        }
+        json.field("start", static_cast<double>(job.options.from) / SAMPLE_RATE);
+        json.key("end");
+        if (job.options.to == SIZE_MAX) {
+            json.null();
+        } else {
+            json.value(static_cast<double>(job.options.to) / SAMPLE_RATE);
+        }
+        json.field("status", result.statusName());
+        json.key("errors");
+        json.beginArray();
+        for (const std::string& error: result.errors) {
+            json.value(error);
+        }
+        json.endArray();
+        json.key("files");
+        json.beginArray();
+        for (const std::string& file: result.files) {
+            json.value(file);
+        }
+        json.endArray();
+        json.field("frames", stats.frames);
+        json.field("seconds", static_cast<double>(stats.frames) / SAMPLE_RATE);
+        json.field("pairs", stats.pairs);
+        json.field("notes", stats.notes);
+        json.field("cachedStems", stats.cachedStems);
+        json.key("timings");
+        json.beginObject();
+        json.field("queued", result.queuedSeconds);
+        json.field("load", result.loadSeconds);
+        json.field("wait", result.waitSeconds);
+        json.field("render", stats.renderSeconds);
+        json.field("mix", stats.mixSeconds);
+        json.field("limit", stats.limitSeconds);
+        json.field("write", result.writeSeconds);
+        json.field("total", result.totalSeconds);
+        json.endObject();
+        json.field("speed", stats.speed());
+        json.key("memory");
+        json.beginObject();
+        json.field("estimated", result.estimatedBytes);
+        json.field("peak", result.peakBytes);
+        json.field("stems", stats.stemBytes);
+        json.field("mixPages", stats.mixPages);
+        json.endObject();
+        json.field("blocks", stats.blocks);
+        json.field("silentBlocks", stats.silentBlocks);
+        json.key("peak");
+        if (stats.peak > 0.0f) {
+            json.value(20.0 * std::log10(static_cast<double>(stats.peak)));
+        } else {
+            json.null();
+        }
+        json.endObject();
+    }
+    json.endArray();
+
+    json.key("summary");
+    json.beginObject();
+    json.field("jobs", jobs.size());
+    json.field("ok", batch.count(RenderJobResult::Status::Ok));
+    json.field("errors", batch.count(RenderJobResult::Status::Errors));
+    json.field("failed", batch.count(RenderJobResult::Status::Failed));
+    json.field("seconds", batch.seconds);
+    json.field("threads", batch.threads);
+    json.field("concurrentJobs", batch.concurrentJobs);
+    json.key("memory");
+    json.beginObject();
+    json.field("budget", batch.memoryBudget);
+    json.field("budgetPeak", batch.budgetPeak);
+    json.field("budgetWaits", batch.budgetWaits);
+    json.field("poolPeak", batch.pool.peak);
+    json.field("poolHitRate", batch.pool.hitRate());
+    json.endObject();
+    json.key("cache");
+    json.beginObject();
+    json.field("budget", batch.cacheBudget);
+    json.field("hits", batch.cacheHits);
+    json.field("misses", batch.cacheMisses);
+    json.endObject();
+    json.endObject();
+    json.endObject();
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// C++17 basic LightDaw buffer pool
+// every stem, stream and temporary AudioBuffer is allocated from here (AudioBuffer uses PoolAllocator, see audio.h).
+// blocks are 64 byte aligned (a cache line, and enough for every vector load in dsp.h) and rounded up to a size class,
+// four classes per octave so at most a quarter is wasted. a freed block goes back to the free list of its class and the next
+// allocation of that class gets it back, so rendering the same song twice (or replacing a stem with one of the same length)
+// doesn't go to the system allocator again. the pool keeps at most BUFFER_POOL_RETAIN bytes of free blocks around,
+// blocks above the largest class always go straight to the system.
+// thread safe (a mutex), so never allocate on the audio thread, the render workers and the render pool may
+
+#define BUFFER_POOL_ALIGNMENT 64
+#define BUFFER_POOL_MIN_CLASS 256 // bytes
+#define BUFFER_POOL_MAX_CLASS (64 * 1024 * 1024) // bytes, about 6 minutes of mono float at 44100 Hz
+#define BUFFER_POOL_RETAIN (128 * 1024 * 1024) // bytes of free blocks kept for reuse
+#define RENDER_ARENA_CHUNK (256 * 1024) // bytes
+
+struct BufferPoolStats {
+    size_t requests = 0;
+    size_t hits = 0; // served from a free list
+    size_t systemAllocations = 0; // went to the system allocator, misses and blocks too large for a class
+    size_t systemFrees = 0;
+    size_t inUse = 0; // bytes handed out right now (rounded up to the class)
+    size_t peak = 0; // highest inUse since the stats were reset
+    size_t pooled = 0; // bytes of free blocks waiting to be reused
+
+    [[nodiscard]] double hitRate() const {
+        return requests > 0 ? static_cast<double>(hits) / static_cast<double>(requests) : 0.0;
+    }
+};
+
+struct BufferPool {
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::vector<size_t> classes; // sizes in bytes, increasing
+    std::vector<FreeBlock*> freeLists; // one per class
+    size_t retain = BUFFER_POOL_RETAIN;
+    BufferPoolStats stats;
+    mutable std::mutex mutex;
+
+    BufferPool() {
+        for (size_t octave = BUFFER_POOL_MIN_CLASS; octave < BUFFER_POOL_MAX_CLASS; octave *= 2) {
+            for (size_t quarter = 1; quarter <= 4; quarter++) {
+                classes.push_back(octave + octave / 4 * quarter);
+            }
+        }
+        classes.insert(classes.begin(), BUFFER_POOL_MIN_CLASS);
+        freeLists.assign(classes.size(), nullptr);
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool() {
+        trim();
+    }
+
+    void* allocate(size_t bytes) {
+        size_t index = classOf(bytes);
+        size_t size = index < classes.size() ? classes[index] : bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.requests++;
+            stats.inUse += size;
+            stats.peak = std::max(stats.peak, stats.inUse);
+            if (index < classes.size() && freeLists[index] != nullptr) {
+                FreeBlock* block = freeLists[index];
+                freeLists[index] = block->next;
+                stats.pooled -= size;
+                stats.hits++;
+                return block;
+            }
+            stats.systemAllocations++;
+        }
+        return ::operator new(size, std::align_val_t(BUFFER_POOL_ALIGNMENT));
+    }
+
+    // bytes has to be what the block was allocated with
+    void deallocate(void* pointer, size_t bytes) {
+        if (pointer == nullptr) return;
+        size_t index = classOf(bytes);
+        size_t size = index < classes.size() ? classes[index] : bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.inUse -= size;
+            if (index < classes.size() && stats.pooled + size <= retain) {
+                auto* block = static_cast<FreeBlock*>(pointer);
+                block->next = freeLists[index];
+                freeLists[index] = block;
+                stats.pooled += size;
+                return;
+            }
+            stats.systemFrees++;
+        }
+        ::operator delete(pointer, std::align_val_t(BUFFER_POOL_ALIGNMENT));
+    }
+
+    // give every free block back to the system
+    void trim() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (FreeBlock*& list : freeLists) {
+            while (list != nullptr) {
+                FreeBlock* next = list->next;
+                ::operator delete(list, std::align_val_t(BUFFER_POOL_ALIGNMENT));
+                stats.systemFrees++;
+                list = next;
+            }
+        }
+        stats.pooled = 0;
+    }
+
+    [[nodiscard]] BufferPoolStats snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    // the counters start over, what is in use and pooled stays
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.requests = 0;
+        stats.hits = 0;
+        stats.systemAllocations = 0;
+        stats.systemFrees = 0;
+        stats.peak = stats.inUse;
+    }
+
+private:
+    // index of the smallest class that fits, classes.size() when none does
+    [[nodiscard]] size_t classOf(size_t bytes) const {
+        return static_cast<size_t>(std::lower_bound(classes.begin(), classes.end(), std::max<size_t>(bytes, 1)) - classes.begin());
+    }
+};
+
+// never destroyed, buffers in other statics (the render cache, the preview bus) can still be freed during exit
+inline BufferPool& bufferPool() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+// a standard allocator on top of bufferPool(), for std::vector
+template<typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() noexcept = default;
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {} // NOLINT(google-explicit-constructor), containers rebind allocators implicitly
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(bufferPool().allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, size_t count) noexcept {
+        bufferPool().deallocate(pointer, count * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+// scratch memory for the temporaries of one render (or one call), handed out by moving a pointer forward.
+// nothing is freed on its own, a RenderArena::Scope gives back everything allocated while it was alive.
+// the chunks come from bufferPool() and are kept until the arena is destroyed, so after the first render the arena never allocates
+struct RenderArena {
+    struct Chunk {
+        unsigned char* memory;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current = 0; // chunk being allocated from
+    size_t used = 0; // bytes used of the current chunk
+    size_t peak = 0; // most bytes ever used at once, over all chunks
+
+    // everything allocated from the arena while the scope is alive is released when it ends
+    struct Scope {
+        RenderArena& arena;
+        size_t current;
+        size_t used;
+
+        explicit Scope(RenderArena& arena) : arena(arena), current(arena.current), used(arena.used) {}
+
+        ~Scope() {
+            arena.current = current;
+            arena.used = used;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    RenderArena() = default;
+    RenderArena(const RenderArena&) = delete;
+    RenderArena& operator=(const RenderArena&) = delete;
+
+    ~RenderArena() {
+        for (Chunk& chunk : chunks) {
+            bufferPool().deallocate(chunk.memory, chunk.size);
+        }
+    }
+
+    // 64 byte aligned, not initialized
+    template<typename T>
+    T* allocate(size_t count) {
+        size_t bytes = (count * sizeof(T) + BUFFER_POOL_ALIGNMENT - 1) & ~static_cast<size_t>(BUFFER_POOL_ALIGNMENT - 1);
+        while (current < chunks.size() && used + bytes > chunks[current].size) {
+            current++; // the rest of a chunk that is too small is skipped until the scope ends
+            used = 0;
+        }
+        if (current == chunks.size()) {
+            size_t size = std::max<size_t>(bytes, RENDER_ARENA_CHUNK);
+            chunks.push_back({static_cast<unsigned char*>(bufferPool().allocate(size)), size});
+        }
+        T* pointer = reinterpret_cast<T*>(chunks[current].memory + used);
+        used += bytes;
+        size_t total = used;
+        for (size_t i = 0; i < current; i++) {
+            total += chunks[i].size;
+        }
+        peak = std::max(peak, total);
+        return pointer;
+    }
+
+    [[nodiscard]] size_t reserved() const {
+        size_t total = 0;
+        for (const Chunk& chunk : chunks) {
+            total += chunk.size;
+        }
+        return total;
+    }
+};
+
+// one per thread, every render worker and render pool thread gets its own so they never share
+inline RenderArena& renderArena() {
+    thread_local RenderArena arena;
+    return arena;
+}
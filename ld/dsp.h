@@ -0,0 +1,332 @@
+#pragma once
+
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// C++17 basic LightDaw dsp kernels
+// the loops every mix goes through: gain, copy with gain, mix (add with gain), gain ramps, peak and sum of squares.
+// like the oscillator kernels there is a scalar version and vector ones picked with the runtime SimdLevel (see dspKernels).
+// the vector versions do a few scalar samples until the output is aligned, use aligned loads for the inputs that are aligned
+// too, and finish the samples that don't fill a vector with the scalar version.
+// these are memory bound, AVX-512 gains nothing over AVX2 here, so it uses the AVX2 kernels.
+// the free functions at the bottom (dspGain, dspMix, ...) are what the rest of the code calls
+
+typedef void (*DspGainKernel)(float* buffer, size_t frames, float gain); // buffer *= gain
+typedef void (*DspScaleKernel)(float* out, const float* in, size_t frames, float gain); // out = in * gain
+typedef void (*DspMixKernel)(float* out, const float* in, size_t frames, float gain); // out += in * gain
+typedef void (*DspRampKernel)(float* buffer, size_t frames, float gain, float step); // buffer[i] *= gain + step * i
+typedef float (*DspPeakKernel)(const float* buffer, size_t frames); // max |buffer[i]|
+typedef double (*DspSquaresKernel)(const float* buffer, size_t frames); // sum of buffer[i]^2
+
+struct DspKernels {
+    DspGainKernel gain;
+    DspScaleKernel scale;
+    DspMixKernel mix;
+    DspRampKernel ramp;
+    DspPeakKernel peak;
+    DspSquaresKernel squares;
+};
+
+// scalar
+
+inline void dspGainScalar(float* buffer, size_t frames, float gain) {
+    for (size_t i = 0; i < frames; i++) {
+        buffer[i] *= gain;
+    }
+}
+
+inline void dspScaleScalar(float* out, const float* in, size_t frames, float gain) {
+    for (size_t i = 0; i < frames; i++) {
+        out[i] = in[i] * gain;
+    }
+}
+
+inline void dspMixScalar(float* out, const float* in, size_t frames, float gain) {
+    for (size_t i = 0; i < frames; i++) {
+        out[i] += in[i] * gain;
+    }
+}
+
+inline void dspRampScalar(float* buffer, size_t frames, float gain, float step) {
+    for (size_t i = 0; i < frames; i++) {
+        buffer[i] *= gain + step * static_cast<float>(i);
+    }
+}
+
+inline float dspPeakScalar(const float* buffer, size_t frames) {
+    float peak = 0.0f;
+    for (size_t i = 0; i < frames; i++) {
+        peak = std::max(peak, std::abs(buffer[i]));
+    }
+    return peak;
+}
+
+inline double dspSquaresScalar(const float* buffer, size_t frames) {
+    double sum = 0.0;
+    for (size_t i = 0; i < frames; i++) {
+        sum += static_cast<double>(buffer[i]) * buffer[i];
+    }
+    return sum;
+}
+
+// how many samples until pointer is aligned to `alignment` bytes (at most frames)
+inline size_t dspHead(const float* pointer, size_t frames, size_t alignment) {
+    size_t misaligned = reinterpret_cast<uintptr_t>(pointer) & (alignment - 1);
+    if (misaligned == 0) return 0;
+    if (misaligned % sizeof(float) != 0) return frames; // not even float aligned, can't be fixed by skipping samples
+    return std::min(frames, (alignment - misaligned) / sizeof(float));
+}
+
+inline bool dspAligned(const float* pointer, size_t alignment) {
+    return (reinterpret_cast<uintptr_t>(pointer) & (alignment - 1)) == 0;
+}
+
+#ifdef LD_SIMD_X86
+
+// SSE2
+
+LD_TARGET_SSE2 inline void dspGainSSE2(float* buffer, size_t frames, float gain) {
+    size_t i = dspHead(buffer, frames, 16);
+    dspGainScalar(buffer, i, gain);
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= frames; i += 4) {
+        _mm_store_ps(buffer + i, _mm_mul_ps(_mm_load_ps(buffer + i), g));
+    }
+    dspGainScalar(buffer + i, frames - i, gain);
+}
+
+LD_TARGET_SSE2 inline void dspScaleSSE2(float* out, const float* in, size_t frames, float gain) {
+    size_t i = dspHead(out, frames, 16);
+    dspScaleScalar(out, in, i, gain);
+    __m128 g = _mm_set1_ps(gain);
+    if (dspAligned(in + i, 16)) {
+        for (; i + 4 <= frames; i += 4) {
+            _mm_store_ps(out + i, _mm_mul_ps(_mm_load_ps(in + i), g));
+        }
+    } else {
+        for (; i + 4 <= frames; i += 4) {
+            _mm_store_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+        }
+    }
+    dspScaleScalar(out + i, in + i, frames - i, gain);
+}
+
+LD_TARGET_SSE2 inline void dspMixSSE2(float* out, const float* in, size_t frames, float gain) {
+    size_t i = dspHead(out, frames, 16);
+    dspMixScalar(out, in, i, gain);
+    __m128 g = _mm_set1_ps(gain);
+    if (dspAligned(in + i, 16)) {
+        for (; i + 4 <= frames; i += 4) {
+            _mm_store_ps(out + i, _mm_add_ps(_mm_load_ps(out + i), _mm_mul_ps(_mm_load_ps(in + i), g)));
+        }
+    } else {
+        for (; i + 4 <= frames; i += 4) {
+            _mm_store_ps(out + i, _mm_add_ps(_mm_load_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+        }
+    }
+    dspMixScalar(out + i, in + i, frames - i, gain);
+}
+
+LD_TARGET_SSE2 inline void dspRampSSE2(float* buffer, size_t frames, float gain, float step) {
+    size_t i = dspHead(buffer, frames, 16);
+    dspRampScalar(buffer, i, gain, step);
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    for (; i + 4 <= frames; i += 4) {
+        __m128 fi = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), index);
+        __m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(fi, _mm_set1_ps(step)));
+        _mm_store_ps(buffer + i, _mm_mul_ps(_mm_load_ps(buffer + i), g));
+    }
+    dspRampScalar(buffer + i, frames - i, gain + step * static_cast<float>(i), step);
+}
+
+LD_TARGET_SSE2 inline float dspPeakSSE2(const float* buffer, size_t frames) {
+    size_t i = dspHead(buffer, frames, 16);
+    float peak = dspPeakScalar(buffer, i);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 p = _mm_setzero_ps();
+    for (; i + 4 <= frames; i += 4) {
+        p = _mm_max_ps(p, _mm_andnot_ps(sign, _mm_load_ps(buffer + i)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, p);
+    for (float lane : lanes) {
+        peak = std::max(peak, lane);
+    }
+    return std::max(peak, dspPeakScalar(buffer + i, frames - i));
+}
+
+LD_TARGET_SSE2 inline double dspSquaresSSE2(const float* buffer, size_t frames) {
+    size_t i = dspHead(buffer, frames, 16);
+    double sum = dspSquaresScalar(buffer, i);
+    // summed in doubles, a float sum of a long buffer loses the quiet parts
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+    for (; i + 4 <= frames; i += 4) {
+        __m128 x = _mm_load_ps(buffer + i);
+        __m128d a = _mm_cvtps_pd(x);
+        __m128d b = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+        low = _mm_add_pd(low, _mm_mul_pd(a, a));
+        high = _mm_add_pd(high, _mm_mul_pd(b, b));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(low, high));
+    return sum + lanes[0] + lanes[1] + dspSquaresScalar(buffer + i, frames - i);
+}
+
+// AVX2 + FMA
+
+LD_TARGET_AVX2 inline void dspGainAVX2(float* buffer, size_t frames, float gain) {
+    size_t i = dspHead(buffer, frames, 32);
+    dspGainScalar(buffer, i, gain);
+    __m256 g = _mm256_set1_ps(gain);
+    for (; i + 8 <= frames; i += 8) {
+        _mm256_store_ps(buffer + i, _mm256_mul_ps(_mm256_load_ps(buffer + i), g));
+    }
+    dspGainScalar(buffer + i, frames - i, gain);
+}
+
+LD_TARGET_AVX2 inline void dspScaleAVX2(float* out, const float* in, size_t frames, float gain) {
+    size_t i = dspHead(out, frames, 32);
+    dspScaleScalar(out, in, i, gain);
+    __m256 g = _mm256_set1_ps(gain);
+    if (dspAligned(in + i, 32)) {
+        for (; i + 8 <= frames; i += 8) {
+            _mm256_store_ps(out + i, _mm256_mul_ps(_mm256_load_ps(in + i), g));
+        }
+    } else {
+        for (; i + 8 <= frames; i += 8) {
+            _mm256_store_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), g));
+        }
+    }
+    dspScaleScalar(out + i, in + i, frames - i, gain);
+}
+
+LD_TARGET_AVX2 inline void dspMixAVX2(float* out, const float* in, size_t frames, float gain) {
+    size_t i = dspHead(out, frames, 32);
+    dspMixScalar(out, in, i, gain);
+    __m256 g = _mm256_set1_ps(gain);
+    if (dspAligned(in + i, 32)) {
+        for (; i + 8 <= frames; i += 8) {
+            _mm256_store_ps(out + i, _mm256_fmadd_ps(_mm256_load_ps(in + i), g, _mm256_load_ps(out + i)));
+        }
+    } else {
+        for (; i + 8 <= frames; i += 8) {
+            _mm256_store_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_load_ps(out + i)));
+        }
+    }
+    dspMixScalar(out + i, in + i, frames - i, gain);
+}
+
+LD_TARGET_AVX2 inline void dspRampAVX2(float* buffer, size_t frames, float gain, float step) {
+    size_t i = dspHead(buffer, frames, 32);
+    dspRampScalar(buffer, i, gain, step);
+    __m256 index = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    for (; i + 8 <= frames; i += 8) {
+        __m256 fi = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), index);
+        __m256 g = _mm256_fmadd_ps(fi, _mm256_set1_ps(step), _mm256_set1_ps(gain));
+        _mm256_store_ps(buffer + i, _mm256_mul_ps(_mm256_load_ps(buffer + i), g));
+    }
+    dspRampScalar(buffer + i, frames - i, gain + step * static_cast<float>(i), step);
+}
+
+LD_TARGET_AVX2 inline float dspPeakAVX2(const float* buffer, size_t frames) {
+    size_t i = dspHead(buffer, frames, 32);
+    float peak = dspPeakScalar(buffer, i);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 p = _mm256_setzero_ps();
+    for (; i + 8 <= frames; i += 8) {
+        p = _mm256_max_ps(p, _mm256_andnot_ps(sign, _mm256_load_ps(buffer + i)));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, p);
+    for (float lane : lanes) {
+        peak = std::max(peak, lane);
+    }
+    return std::max(peak, dspPeakScalar(buffer + i, frames - i));
+}
+
+LD_TARGET_AVX2 inline double dspSquaresAVX2(const float* buffer, size_t frames) {
+    size_t i = dspHead(buffer, frames, 32);
+    double sum = dspSquaresScalar(buffer, i);
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_load_ps(buffer + i);
+        __m256d a = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+        __m256d b = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+        low = _mm256_fmadd_pd(a, a, low);
+        high = _mm256_fmadd_pd(b, b, high);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(low, high));
+    return sum + lanes[0] + lanes[1] + lanes[2] + lanes[3] + dspSquaresScalar(buffer + i, frames - i);
+}
+
+#endif // LD_SIMD_X86
+
+inline DspKernels dspKernelsFor(SimdLevel level) {
+    switch (level) {
+#ifdef LD_SIMD_X86
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2:
+            return {dspGainAVX2, dspScaleAVX2, dspMixAVX2, dspRampAVX2, dspPeakAVX2, dspSquaresAVX2};
+        case SimdLevel::SSE2:
+            return {dspGainSSE2, dspScaleSSE2, dspMixSSE2, dspRampSSE2, dspPeakSSE2, dspSquaresSSE2};
+#endif
+        default:
+            return {dspGainScalar, dspScaleScalar, dspMixScalar, dspRampScalar, dspPeakScalar, dspSquaresScalar};
+    }
+}
+
+// the kernels of the level that is active right now, like oscKernel this follows setSimdLevel (forcing scalar applies to mixing too)
+inline const DspKernels& dspKernels(SimdLevel level = simdLevel()) {
+    static const DspKernels scalar = dspKernelsFor(SimdLevel::Scalar);
+    static const DspKernels sse2 = dspKernelsFor(SimdLevel::SSE2);
+    static const DspKernels avx2 = dspKernelsFor(SimdLevel::AVX2);
+    switch (level) {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2:
+            return avx2;
+        case SimdLevel::SSE2:
+            return sse2;
+        default:
+            return scalar;
+    }
+}
+
+inline void dspGain(float* buffer, size_t frames, float gain) {
+    dspKernels().gain(buffer, frames, gain);
+}
+
+inline void dspScale(float* out, const float* in, size_t frames, float gain) {
+    dspKernels().scale(out, in, frames, gain);
+}
+
+inline void dspMix(float* out, const float* in, size_t frames, float gain = 1.0f) {
+    dspKernels().mix(out, in, frames, gain);
+}
+
+// fade from gain to end over the buffer, end is reached on the sample after the last one so ramps can be chained
+inline void dspRamp(float* buffer, size_t frames, float gain, float end) {
+    if (frames == 0) return;
+    dspKernels().ramp(buffer, frames, gain, (end - gain) / static_cast<float>(frames));
+}
+
+// constant power, pan in [-1, 1] from left to right, left and right are overwritten
+inline void dspPan(const float* in, float* left, float* right, size_t frames, float pan) {
+    float angle = (std::clamp(pan, -1.0f, 1.0f) + 1.0f) * 0.25f * 3.14159265358979f;
+    dspScale(left, in, frames, std::cos(angle));
+    dspScale(right, in, frames, std::sin(angle));
+}
+
+inline float dspPeak(const float* buffer, size_t frames) {
+    return dspKernels().peak(buffer, frames);
+}
+
+inline float dspRms(const float* buffer, size_t frames) {
+    if (frames == 0) return 0.0f;
+    return static_cast<float>(std::sqrt(dspKernels().squares(buffer, frames) / static_cast<double>(frames)));
+}
@@ -185,13 +185,19 @@ std::vector<uint8_t> loadFile(const std::string& path) {
     return buffer;
 }
 
-void writeFile(const std::string& path, const std::vector<uint8_t>& buffer) {
+// false when the file couldn't be written (the reason is printed)
+bool writeFile(const std::string& path, const std::vector<uint8_t>& buffer) {
     std::ofstream file(path, std::ios::binary);
     if (!file.is_open()) {
         std::cerr << "Failed to open file: " << path << std::endl;
-        return;
+        return false;
     }
     file.write(reinterpret_cast<const char*>(buffer.data()), (std::streamsize)buffer.size());
+    if (!file.good()) {
+        std::cerr << "Failed to write file: " << path << std::endl;
+        return false;
+    }
+    return true;
 }
 
 struct Writer {
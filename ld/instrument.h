@@ -7,19 +7,47 @@
 class Instrument {
 public:
     float volume = 1.0;
+    bool edited = false; // a parameter was changed from the gui (see updateGui), whoever re-renders the instrument clears it
 
-    virtual AudioBuffer generateSamples(size_t sampleCount, double freq, double vol) = 0;
+    // add `frames` samples of a note to out, offset is how many samples into the note the block starts (see Synth::process)
+    virtual void process(float* out, size_t frames, double freq, double vol, size_t offset = 0) = 0;
+
+    virtual AudioBuffer generateSamples(size_t sampleCount, double freq, double vol) {
+        AudioBuffer buffer(sampleCount);
+        process(buffer.data(), sampleCount, freq, vol);
+        return buffer;
+    }
     virtual AudioBuffer generateSeconds(double seconds, double freq, double vol) { // freq in Hz, vol in [0, 1]
         return generateSamples(static_cast<size_t>(seconds * SAMPLE_RATE), freq, vol);
     }
 
+    // add a block of one voice from a VoicePool to out and advance the voice (see voice.h)
+    // by default there is no release tail, the voice ends on note off
+    virtual void processVoice(Voice& voice, float* out, size_t frames) {
+        if (voice.released) {
+            voice.active = false;
+            return;
+        }
+        process(out, frames, voice.freq, voice.vol, voice.age);
+        voice.age += frames;
+        voice.level = 1.0f;
+    }
+
+    // how long a voice keeps sounding after note off, in samples
+    [[nodiscard]] virtual size_t releaseSamples() const {
+        return 0;
+    }
+
+    // an independent copy (parameters included), every render task works on its own copy so they can run in parallel
+    [[nodiscard]] virtual Instrument* clone() const = 0;
+
     // update will be called every frame, time is in seconds
     // it will also let the synth know the midi bpm
     virtual void update(double time, double bpm) {}
     // these functions are to let the instrument know when a note is played, this allows for more complex instruments
     // these functions are not required to be implemented
-    // the generatesamples functions will also be called when a note is played.
-    // noteon will be called right before generatesamples is called
+    // process will be called for every block the note is sounding in.
+    // noteon will be called right before the first block, noteoff right after the last one
     virtual void noteOn(double freq, double vol) {}
     virtual void noteOff(double freq) {}
 
@@ -38,11 +66,13 @@ public:
         return Success;
     }
 
+    // audition a note on the preview bus
     void playMidi(int note, double sec) {
         double freq = 440.0 * std::pow(2.0, (note - 69) / 12.0);
-        auto b = generateSeconds(sec, freq, 1.0);
-        playtest(b);
-
+        auto frames = static_cast<size_t>(sec * SAMPLE_RATE);
+        previewBus().trigger(frames, [&](float* out) {
+            process(out, frames, freq, 1.0);
+        });
     }
 };
 
@@ -59,14 +89,37 @@ public:
         }
     }
 
-    AudioBuffer generateSamples(size_t sampleCount, double freq, double vol) override {
+    void process(float* out, size_t frames, double freq, double vol, size_t offset = 0) override {
         if (synth == nullptr) {
-            std::cerr << "Error: SynthInstrument::generateSamples called with no synth" << std::endl;
-            return AudioBuffer(sampleCount);
+            std::cerr << "Error: SynthInstrument::process called with no synth" << std::endl;
+            return;
         }
         synth->frequency = (float)freq;
         synth->amplitude = (float)vol * volume;
-        return synth->generateSamples(sampleCount);
+        synth->process(out, frames, offset);
+    }
+
+    void processVoice(Voice& voice, float* out, size_t frames) override {
+        if (synth == nullptr) {
+            voice.active = false;
+            return;
+        }
+        synth->frequency = (float)voice.freq;
+        synth->amplitude = (float)voice.vol * volume;
+        synth->processVoice(voice, out, frames);
+    }
+
+    [[nodiscard]] size_t releaseSamples() const override {
+        if (synth != nullptr) {
+            return synth->releaseSamples();
+        }
+        return 0;
+    }
+
+    [[nodiscard]] Instrument* clone() const override {
+        auto* copy = new SynthInstrument(synth != nullptr ? synth->clone() : nullptr);
+        copy->volume = volume;
+        return copy;
     }
 
     void update(double time, double bpm) override {
@@ -91,6 +144,10 @@ public:
         if (synth != nullptr) {
             if (synth->open)
                 synth->drawGui();
+            if (synth->edited) {
+                synth->edited = false;
+                edited = true;
+            }
         }
     }
 
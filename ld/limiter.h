@@ -0,0 +1,198 @@
+#pragma once
+
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// C++17 basic LightDaw master limiter
+// everything is mixed unclamped, so the mix doesn't depend on the order things were added in, and the sum is brought under
+// the ceiling once, on the master. clamping would square off every peak, the limiter instead looks LIMITER_LOOKAHEAD samples
+// ahead and turns the gain down smoothly before a peak arrives, and lets it come back up with the release time.
+//
+// per sample: the gain computer works out the gain that would put the sample exactly at the ceiling (vectorized, see
+// limiterGainKernel), the lowest of those over the lookahead window is held, the release only lets the gain rise slowly,
+// and a moving average over the lookahead smooths the attack. every gain in the average is at most the gain the delayed sample
+// needs, so the output never goes over the ceiling. the output is LIMITER_LOOKAHEAD samples late
+
+#define LIMITER_LOOKAHEAD 64 // samples, about 1.5 ms, a power of two
+#define LIMITER_CEILING_DB (-0.3f)
+#define LIMITER_RELEASE_MS 50.0f
+#define LIMITER_CHUNK 256 // gains are computed for this many samples at a time
+
+typedef void (*LimiterGainKernel)(const float* in, float* gain, size_t frames, float ceiling);
+
+// gain[i] = the gain that brings in[i] down to the ceiling, 1 if it already is under
+inline void limiterGainScalar(const float* in, float* gain, size_t frames, float ceiling) {
+    for (size_t i = 0; i < frames; i++) {
+        gain[i] = ceiling / std::max(std::abs(in[i]), ceiling);
+    }
+}
+
+#ifdef LD_SIMD_X86
+
+LD_TARGET_SSE2 inline void limiterGainSSE2(const float* in, float* gain, size_t frames, float ceiling) {
+    __m128 c = _mm_set1_ps(ceiling);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 x = _mm_andnot_ps(sign, _mm_loadu_ps(in + i));
+        _mm_storeu_ps(gain + i, _mm_div_ps(c, _mm_max_ps(x, c)));
+    }
+    limiterGainScalar(in + i, gain + i, frames - i, ceiling);
+}
+
+LD_TARGET_AVX2 inline void limiterGainAVX2(const float* in, float* gain, size_t frames, float ceiling) {
+    __m256 c = _mm256_set1_ps(ceiling);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_andnot_ps(sign, _mm256_loadu_ps(in + i));
+        _mm256_storeu_ps(gain + i, _mm256_div_ps(c, _mm256_max_ps(x, c)));
+    }
+    limiterGainScalar(in + i, gain + i, frames - i, ceiling);
+}
+
+LD_TARGET_AVX512 inline void limiterGainAVX512(const float* in, float* gain, size_t frames, float ceiling) {
+    __m512 c = _mm512_set1_ps(ceiling);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m512 x = _mm512_abs_ps(_mm512_loadu_ps(in + i));
+        _mm512_storeu_ps(gain + i, _mm512_div_ps(c, _mm512_max_ps(x, c)));
+    }
+    limiterGainScalar(in + i, gain + i, frames - i, ceiling);
+}
+
+#endif // LD_SIMD_X86
+
+inline LimiterGainKernel limiterGainKernel(SimdLevel level = simdLevel()) {
+    switch (level) {
+#ifdef LD_SIMD_X86
+        case SimdLevel::AVX512:
+            return limiterGainAVX512;
+        case SimdLevel::AVX2:
+            return limiterGainAVX2;
+        case SimdLevel::SSE2:
+            return limiterGainSSE2;
+#endif
+        default:
+            return limiterGainScalar;
+    }
+}
+
+inline float decibelsToGain(float db) {
+    return std::pow(10.0f, db / 20.0f);
+}
+
+// streaming, one instance per signal. process never allocates, it is safe on the audio thread
+struct Limiter {
+    double sampleRate;
+    float ceiling = decibelsToGain(LIMITER_CEILING_DB);
+    float releaseCoefficient = 0; // how much of the distance to the held gain is left after a sample
+    LimiterGainKernel kernel = limiterGainKernel();
+
+    float delay[LIMITER_LOOKAHEAD]{}; // the input, LIMITER_LOOKAHEAD samples back
+    float averaged[LIMITER_LOOKAHEAD]{}; // the gains in the moving average
+    double sum = LIMITER_LOOKAHEAD; // of averaged
+    // the lowest gain over the last LIMITER_LOOKAHEAD + 1 samples, a queue of increasing gains (a sliding window minimum)
+    float holdGain[2 * LIMITER_LOOKAHEAD]{};
+    size_t holdTime[2 * LIMITER_LOOKAHEAD]{};
+    size_t holdFirst = 0;
+    size_t holdCount = 0;
+    float current = 1.0f; // after the release
+    size_t time = 0;
+    float reduction = 1.0f; // lowest gain of the last process, for meters
+
+    explicit Limiter(double sampleRate) : sampleRate(sampleRate) {
+        setRelease(LIMITER_RELEASE_MS);
+        reset();
+    }
+
+    void setCeiling(float db) {
+        ceiling = decibelsToGain(db);
+    }
+
+    void setRelease(float milliseconds) {
+        releaseCoefficient = milliseconds > 0 ? static_cast<float>(std::exp(-1000.0 / (milliseconds * sampleRate))) : 0.0f;
+    }
+
+    // forget everything, after a seek for example
+    void reset() {
+        std::fill(std::begin(delay), std::end(delay), 0.0f);
+        std::fill(std::begin(averaged), std::end(averaged), 1.0f);
+        sum = LIMITER_LOOKAHEAD;
+        holdFirst = 0;
+        holdCount = 0;
+        current = 1.0f;
+        time = 0;
+    }
+
+    // in place, the output is LIMITER_LOOKAHEAD samples late
+    void process(float* samples, size_t frames) {
+        float gains[LIMITER_CHUNK];
+        reduction = 1.0f;
+        for (size_t start = 0; start < frames; start += LIMITER_CHUNK) {
+            size_t count = std::min<size_t>(LIMITER_CHUNK, frames - start);
+            float* chunk = samples + start;
+            kernel(chunk, gains, count, ceiling);
+            for (size_t i = 0; i < count; i++) {
+                float held = hold(gains[i]);
+                current = held < current ? held : held + (current - held) * releaseCoefficient;
+                size_t slot = time & (LIMITER_LOOKAHEAD - 1);
+                sum += current - averaged[slot];
+                averaged[slot] = current;
+                float gain = static_cast<float>(sum / LIMITER_LOOKAHEAD);
+                reduction = std::min(reduction, gain);
+                float input = chunk[i];
+                chunk[i] = delay[slot] * gain;
+                delay[slot] = input;
+                time++;
+            }
+        }
+    }
+
+    // go through `frames` samples of silence without producing them, the gain keeps recovering as if they had been processed.
+    // only when the delay line is silent already (LIMITER_LOOKAHEAD silent samples were processed), the output would be silence
+    void skipSilence(size_t frames) {
+        float zeros[LIMITER_LOOKAHEAD + 1]{};
+        size_t exact = std::min<size_t>(frames, LIMITER_LOOKAHEAD + 1); // until the hold window only has silence in it
+        process(zeros, exact);
+        size_t rest = frames - exact;
+        if (rest == 0) return;
+        // from here on every sample wants a gain of 1, the release is a plain exponential, and the average follows it
+        current = 1.0f - (1.0f - current) * std::pow(releaseCoefficient, static_cast<float>(rest));
+        std::fill(std::begin(averaged), std::end(averaged), current);
+        sum = static_cast<double>(current) * LIMITER_LOOKAHEAD;
+        holdCount = 0;
+        time += rest;
+    }
+
+    // limit a whole buffer (a std::vector of float, with any allocator), without the delay
+    template<typename Buffer>
+    static void limitBuffer(Buffer& buffer, double sampleRate, float ceilingDb = LIMITER_CEILING_DB, float releaseMs = LIMITER_RELEASE_MS) {
+        Limiter limiter(sampleRate);
+        limiter.setCeiling(ceilingDb);
+        limiter.setRelease(releaseMs);
+        size_t size = buffer.size();
+        buffer.resize(size + LIMITER_LOOKAHEAD, 0.0f);
+        limiter.process(buffer.data(), buffer.size());
+        buffer.erase(buffer.begin(), buffer.begin() + LIMITER_LOOKAHEAD);
+    }
+
+private:
+    float hold(float gain) {
+        while (holdCount > 0 && holdGain[(holdFirst + holdCount - 1) & (2 * LIMITER_LOOKAHEAD - 1)] >= gain) {
+            holdCount--;
+        }
+        size_t back = (holdFirst + holdCount) & (2 * LIMITER_LOOKAHEAD - 1);
+        holdGain[back] = gain;
+        holdTime[back] = time;
+        holdCount++;
+        if (holdTime[holdFirst] + LIMITER_LOOKAHEAD < time) {
+            holdFirst = (holdFirst + 1) & (2 * LIMITER_LOOKAHEAD - 1);
+            holdCount--;
+        }
+        return holdGain[holdFirst];
+    }
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+#include "audio.h"
+#include <MidiFile.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+// C++17 basic LightDaw note tables
+// a midi file is a list of tracks of events in ticks, to render it we need notes in samples. instead of going through
+// the events (and the tempo map) on every render, every midi is compiled into a flat table once, when it is imported.
+// the table is a structure of arrays sorted by start, so the render loops that only look at the start and end of notes
+// don't have to pull the rest of the note through the cache
+
+struct NoteTable {
+    std::vector<size_t> start; // in samples, sorted
+    std::vector<size_t> length; // in samples
+    std::vector<double> freq; // in Hz
+    std::vector<double> vol; // [0, 1]
+    std::vector<uint8_t> key; // midi key number
+    std::vector<uint8_t> velocity;
+
+    // a centered interval tree over the notes, built by sort (see forEachOverlapping). every node holds the notes that
+    // sound at its center once sorted by start and once by end (latest first), the notes that end before the center
+    // are under left and the ones that start after it under right
+    struct IntervalNode {
+        size_t center = 0;
+        size_t first = 0; // the node's notes are [first, first + count) of byStart and byEnd
+        size_t count = 0;
+        size_t left = NO_INTERVAL_NODE;
+        size_t right = NO_INTERVAL_NODE;
+    };
+
+    static constexpr size_t NO_INTERVAL_NODE = SIZE_MAX;
+
+    std::vector<IntervalNode> intervals; // the root is intervals[0]
+    std::vector<size_t> byStart;
+    std::vector<size_t> byEnd;
+    size_t lastEnd = 0; // where the last note ends
+    size_t maxOverlap = 0; // the most notes that sound at the same time
+
+    [[nodiscard]] size_t size() const {
+        return start.size();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return start.empty();
+    }
+
+    [[nodiscard]] size_t end(size_t index) const {
+        return start[index] + length[index];
+    }
+
+    // where the last note ends, in samples, known without rendering anything
+    [[nodiscard]] size_t duration() const {
+        return lastEnd;
+    }
+
+    static double keyFrequency(uint8_t key) {
+        return 440 * std::pow(2, (key - 69) / 12.0);
+    }
+
+    static double velocityVolume(uint8_t velocity) {
+        return velocity / 127.0 * 0.5;
+    }
+
+    // call sort() after adding notes, the table can't be searched before that
+    void add(size_t noteStart, size_t noteLength, uint8_t noteKey, uint8_t noteVelocity) {
+        start.push_back(noteStart);
+        length.push_back(noteLength);
+        freq.push_back(keyFrequency(noteKey));
+        vol.push_back(velocityVolume(noteVelocity));
+        key.push_back(noteKey);
+        velocity.push_back(noteVelocity);
+    }
+
+    // stable, notes that start together stay in the order they were added
+    void sort() {
+        std::vector<size_t> order(size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return start[a] < start[b];
+        });
+        permute(start, order);
+        permute(length, order);
+        permute(freq, order);
+        permute(vol, order);
+        permute(key, order);
+        buildIntervals();
+    }
+
+    // f(index) for every note that sounds somewhere in [from, to), that starts before `to` and ends after `from`
+    // (from == to are the notes that started before `from` and are still sounding there). notes without length never sound.
+    // the notes come in no particular order. O(log n + k) for k notes, a long note doesn't make the notes after it any
+    // slower to find. returns how many notes were looked at, at most k plus one per tree level
+    template<typename F>
+    size_t forEachOverlapping(size_t from, size_t to, F&& f) const {
+        if (intervals.empty()) return 0;
+        return visitIntervals(0, from, std::max(from, to), f);
+    }
+
+    // the file is taken by value, the time analysis changes it
+    static NoteTable fromMidi(smf::MidiFile file) {
+        NoteTable table;
+        file.doTimeAnalysis();
+        file.linkNotePairs();
+        if (file.getFileDurationInSeconds() < 0) {
+            std::cerr << "Error: File duration is negative" << std::endl;
+            return table;
+        }
+        for (int i = 0; i < file.getTrackCount(); i++) {
+            smf::MidiEventList &track = file[i];
+            for (int j = 0; j < track.size(); j++) {
+                smf::MidiEvent &event = track[j];
+                if (event.isNoteOn()) {
+                    table.add(AudioOffset::fromSeconds(file.getTimeInSeconds(event.tick)).samples,
+                              static_cast<size_t>(event.getDurationInSeconds() * SAMPLE_RATE),
+                              static_cast<uint8_t>(event.getKeyNumber()), static_cast<uint8_t>(event.getVelocity()));
+                }
+            }
+        }
+        table.sort();
+        return table;
+    }
+
+private:
+    void buildIntervals() {
+        intervals.clear();
+        byStart.clear();
+        byEnd.clear();
+        lastEnd = 0;
+        maxOverlap = 0;
+        std::vector<size_t> sounding; // sorted by start, as the table is
+        std::vector<size_t> ends;
+        for (size_t i = 0; i < size(); i++) {
+            lastEnd = std::max(lastEnd, end(i));
+            if (length[i] == 0) continue;
+            sounding.push_back(i);
+            ends.push_back(end(i));
+        }
+        std::sort(ends.begin(), ends.end());
+        size_t ended = 0;
+        for (size_t i = 0; i < sounding.size(); i++) {
+            while (ends[ended] <= start[sounding[i]]) ended++;
+            maxOverlap = std::max(maxOverlap, i + 1 - ended);
+        }
+        byStart.reserve(sounding.size());
+        byEnd.reserve(sounding.size());
+        buildInterval(sounding);
+    }
+
+    // the center is the start of the middle note, so that note is in the node and every side has at most half the notes
+    size_t buildInterval(const std::vector<size_t>& notes) {
+        if (notes.empty()) return NO_INTERVAL_NODE;
+        size_t center = start[notes[notes.size() / 2]];
+        std::vector<size_t> left;
+        std::vector<size_t> right;
+        size_t node = intervals.size();
+        intervals.push_back({center, byStart.size(), 0});
+        for (size_t index : notes) {
+            if (end(index) <= center) {
+                left.push_back(index);
+            } else if (start[index] > center) {
+                right.push_back(index);
+            } else {
+                byStart.push_back(index);
+            }
+        }
+        size_t first = intervals[node].first;
+        intervals[node].count = byStart.size() - first;
+        byEnd.insert(byEnd.end(), byStart.begin() + static_cast<std::ptrdiff_t>(first), byStart.end());
+        std::stable_sort(byEnd.begin() + static_cast<std::ptrdiff_t>(first), byEnd.end(), [this](size_t a, size_t b) {
+            return end(a) > end(b);
+        });
+        size_t leftNode = buildInterval(left);
+        size_t rightNode = buildInterval(right);
+        intervals[node].left = leftNode;
+        intervals[node].right = rightNode;
+        return node;
+    }
+
+    // every note of a node sounds at its center, so when [from, to) ends before the center only their starts have to be
+    // checked, when it starts after the center only their ends, and when it has the center in it they all sound
+    template<typename F>
+    size_t visitIntervals(size_t index, size_t from, size_t to, F& f) const {
+        const IntervalNode& node = intervals[index];
+        size_t visited = 0;
+        if (to <= node.center) {
+            for (size_t i = node.first; i < node.first + node.count; i++) {
+                visited++;
+                if (start[byStart[i]] >= to) break;
+                f(byStart[i]);
+            }
+            if (node.left != NO_INTERVAL_NODE) visited += visitIntervals(node.left, from, to, f);
+        } else if (from >= node.center) {
+            for (size_t i = node.first; i < node.first + node.count; i++) {
+                visited++;
+                if (end(byEnd[i]) <= from) break;
+                f(byEnd[i]);
+            }
+            if (node.right != NO_INTERVAL_NODE) visited += visitIntervals(node.right, from, to, f);
+        } else {
+            for (size_t i = node.first; i < node.first + node.count; i++) {
+                visited++;
+                f(byStart[i]);
+            }
+            if (node.left != NO_INTERVAL_NODE) visited += visitIntervals(node.left, from, to, f);
+            if (node.right != NO_INTERVAL_NODE) visited += visitIntervals(node.right, from, to, f);
+        }
+        return visited;
+    }
+
+    template<typename T>
+    static void permute(std::vector<T>& values, const std::vector<size_t>& order) {
+        std::vector<T> sorted(values.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            sorted[i] = values[order[i]];
+        }
+        values = std::move(sorted);
+    }
+};
+
+typedef std::shared_ptr<const NoteTable> NoteTableRef; // tables are never changed once compiled, so they are shared
+
+// a midi as the project stores it, the file (for saving) and its compiled notes (for rendering)
+struct MidiClip {
+    smf::MidiFile file;
+    NoteTableRef notes = std::make_shared<const NoteTable>();
+
+    MidiClip() = default;
+    explicit MidiClip(smf::MidiFile midi) : file(std::move(midi)), notes(std::make_shared<const NoteTable>(NoteTable::fromMidi(file))) {}
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "osckernels.h"
+#include "wavetable.h"
+#include <cmath>
+#include <cstddef>
+
+// C++17 basic LightDaw oscillator core
+// instead of computing sin(2*pi*f*t) from the time since the note started, every oscillator keeps a running phase
+// (in cycles, [0, 1)) that is advanced by freq / sampleRate every sample. the phase is the only state, so it can be
+// stored in a voice and picked up again on the next block, and changing the frequency never makes the wave jump.
+// the blocks themselves are rendered by the kernels in osckernels.h, or read from the band-limited tables in wavetable.h
+
+#define OSC_CHUNK 64 // the kernels work in float, so the phase is handed over from the double accumulator this often
+
+enum class OscMode {
+    Direct, // compute the wave from the phase, cheap and exact but square/saw/triangle alias at high notes
+    Wavetable // band-limited tables, no aliasing
+};
+
+struct Oscillator {
+    double phase = 0.0; // in cycles, always in [0, 1)
+    double increment = 0.0; // cycles per sample
+    OscMode mode = OscMode::Direct;
+
+    Oscillator() = default;
+    Oscillator(double phase, double increment, OscMode mode = OscMode::Direct) : phase(phase), increment(increment), mode(mode) {}
+
+    void setFrequency(double freq, double sampleRate) {
+        increment = freq / sampleRate;
+    }
+
+    // phase the oscillator would have after `samples` samples, starting from 0
+    static double phaseAt(double increment, size_t samples) {
+        double p = increment * static_cast<double>(samples);
+        return p - std::floor(p);
+    }
+
+    // sin(2 * pi * phase) without calling std::sin (error < 1e-6)
+    static float sine(float phase) {
+        return oscSineScalar(phase);
+    }
+
+    static float sample(Waveform wave, float phase) {
+        switch (wave) {
+            case Waveform::Sine:
+                return oscWaveScalar<Waveform::Sine>(phase);
+            case Waveform::Triangle:
+                return oscWaveScalar<Waveform::Triangle>(phase);
+            case Waveform::Square:
+                return oscWaveScalar<Waveform::Square>(phase);
+            case Waveform::Saw:
+                return oscWaveScalar<Waveform::Saw>(phase);
+        }
+        return 0.0f;
+    }
+
+    void advance() {
+        phase += increment;
+        if (phase >= 1.0) {
+            phase -= std::floor(phase);
+        }
+    }
+
+    // move the phase forward without rendering anything
+    void skip(size_t samples) {
+        double p = phase + increment * static_cast<double>(samples);
+        phase = p - std::floor(p);
+    }
+
+    float next(Waveform wave) {
+        float value = sample(wave, static_cast<float>(phase));
+        advance();
+        return value;
+    }
+
+    // add `frames` samples scaled by gain to out
+    void process(Waveform wave, float* out, size_t frames, float gain) {
+        processRamp(wave, out, frames, gain, 0.0f);
+    }
+
+    // add `frames` samples to out, scaled by a gain that starts at gain and changes by step every sample
+    // this is what the linear segments of an envelope are made of
+    void processRamp(Waveform wave, float* out, size_t frames, float gain, float step) {
+        if (mode == OscMode::Wavetable) {
+            const float* table = wavetables().table(wave, increment);
+            for (size_t done = 0; done < frames; done += OSC_CHUNK) {
+                size_t n = std::min<size_t>(OSC_CHUNK, frames - done);
+                oscRampTable(table, out + done, n, static_cast<float>(phase), static_cast<float>(increment), gain + step * static_cast<float>(done), step);
+                skip(n);
+            }
+            return;
+        }
+        OscKernel kernel = oscKernel(wave);
+        for (size_t done = 0; done < frames; done += OSC_CHUNK) {
+            size_t n = std::min<size_t>(OSC_CHUNK, frames - done);
+            kernel(out + done, n, static_cast<float>(phase), static_cast<float>(increment), gain + step * static_cast<float>(done), step);
+            skip(n);
+        }
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// C++17 basic LightDaw oscillator kernels
+// every kernel adds `frames` samples of a wave to out, scaled by a linear gain ramp (gain + step * i),
+// which covers both plain oscillators (step = 0) and the linear segments of an envelope.
+// the phase of sample i is frac(phase + i * inc), so a kernel has no state and the caller advances the phase.
+//
+// there is a scalar fallback and SSE2, AVX2 (+FMA) and AVX-512 versions, oscKernel picks one with the runtime
+// detected SimdLevel. all of them use the same math (no std::sin, see Oscillator::sine), the vector versions only differ
+// from the scalar one by rounding (fused multiply-add, evaluation order). the documented tolerance is
+// OSC_KERNEL_TOLERANCE per unit of gain, for phase + frames * inc < 64 (Oscillator hands kernels at most OSC_CHUNK samples).
+// the phase itself is rounded the same way everywhere (phase + i * inc, never fused, the engine is built with
+// -ffp-contract=off), far from 0 one ulp of phase is more than the tolerance. tests/test_osckernels.cpp checks every
+// kernel against the scalar one.
+
+#define OSC_KERNEL_TOLERANCE 1e-5f
+
+enum class Waveform {
+    Sine,
+    Triangle,
+    Square,
+    Saw
+};
+
+typedef void (*OscKernel)(float* out, size_t frames, float phase, float inc, float gain, float step);
+
+// taylor coefficients for sin(x) on [-pi/2, pi/2], error < 1e-6
+#define OSC_SIN_C3 (-1.0f / 6.0f)
+#define OSC_SIN_C5 (1.0f / 120.0f)
+#define OSC_SIN_C7 (-1.0f / 5040.0f)
+#define OSC_SIN_C9 (1.0f / 362880.0f)
+#define OSC_SIN_C11 (-1.0f / 39916800.0f)
+#define OSC_TWO_PI 6.28318530717958647692f
+
+// scalar
+
+// sin(2 * pi * phase) for phase in [0, 1), folded into a quarter wave
+inline float oscSineScalar(float phase) {
+    float x = phase - 0.5f; // sin(2 pi p) = -sin(2 pi (p - 0.5))
+    x = std::min(x, 0.5f - x);
+    x = std::max(x, -0.5f - x);
+    x *= OSC_TWO_PI;
+    float x2 = x * x;
+    float s = x * (1.0f + x2 * (OSC_SIN_C3 + x2 * (OSC_SIN_C5 + x2 * (OSC_SIN_C7 + x2 * (OSC_SIN_C9 + x2 * OSC_SIN_C11)))));
+    return -s;
+}
+
+template<Waveform W>
+inline float oscWaveScalar(float phase) {
+    if constexpr (W == Waveform::Sine) {
+        return oscSineScalar(phase);
+    } else if constexpr (W == Waveform::Square) {
+        return phase < 0.5f ? 1.0f : -1.0f;
+    } else {
+        float saw = 2.0f * (phase - std::floor(phase + 0.5f));
+        if constexpr (W == Waveform::Triangle) {
+            return 2.0f * std::abs(saw) - 1.0f;
+        } else {
+            return saw;
+        }
+    }
+}
+
+// samples [begin, frames) of a ramp, the vector kernels finish their tail with this. the tail keeps the phase and gain of
+// sample 0 and the index of the sample, starting over from phase + begin * inc would round differently from the scalar kernel
+template<Waveform W>
+inline void oscRampScalarFrom(size_t begin, float* out, size_t frames, float phase, float inc, float gain, float step) {
+    for (size_t i = begin; i < frames; i++) {
+        float p = phase + static_cast<float>(i) * inc;
+        p -= std::floor(p);
+        out[i] += (gain + step * static_cast<float>(i)) * oscWaveScalar<W>(p);
+    }
+}
+
+template<Waveform W>
+inline void oscRampScalar(float* out, size_t frames, float phase, float inc, float gain, float step) {
+    oscRampScalarFrom<W>(0, out, frames, phase, inc, gain, step);
+}
+
+#ifdef LD_SIMD_X86
+
+// SSE2
+
+LD_TARGET_SSE2 inline __m128 oscFloorSSE2(__m128 x) {
+    // no roundps before SSE4.1, truncate and fix up the negative values
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+template<Waveform W>
+LD_TARGET_SSE2 inline __m128 oscWaveSSE2(__m128 p) {
+    if constexpr (W == Waveform::Sine) {
+        __m128 x = _mm_sub_ps(p, _mm_set1_ps(0.5f));
+        x = _mm_min_ps(x, _mm_sub_ps(_mm_set1_ps(0.5f), x));
+        x = _mm_max_ps(x, _mm_sub_ps(_mm_set1_ps(-0.5f), x));
+        x = _mm_mul_ps(x, _mm_set1_ps(OSC_TWO_PI));
+        __m128 x2 = _mm_mul_ps(x, x);
+        __m128 s = _mm_set1_ps(OSC_SIN_C11);
+        s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(OSC_SIN_C9));
+        s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(OSC_SIN_C7));
+        s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(OSC_SIN_C5));
+        s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(OSC_SIN_C3));
+        s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(1.0f));
+        return _mm_mul_ps(s, _mm_sub_ps(_mm_setzero_ps(), x));
+    } else if constexpr (W == Waveform::Square) {
+        __m128 mask = _mm_cmplt_ps(p, _mm_set1_ps(0.5f));
+        return _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(1.0f)), _mm_andnot_ps(mask, _mm_set1_ps(-1.0f)));
+    } else {
+        __m128 saw = _mm_mul_ps(_mm_set1_ps(2.0f), _mm_sub_ps(p, oscFloorSSE2(_mm_add_ps(p, _mm_set1_ps(0.5f)))));
+        if constexpr (W == Waveform::Triangle) {
+            __m128 abs = _mm_andnot_ps(_mm_set1_ps(-0.0f), saw);
+            return _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.0f), abs), _mm_set1_ps(1.0f));
+        } else {
+            return saw;
+        }
+    }
+}
+
+template<Waveform W>
+LD_TARGET_SSE2 void oscRampSSE2(float* out, size_t frames, float phase, float inc, float gain, float step) {
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 fi = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), index);
+        __m128 p = _mm_add_ps(_mm_set1_ps(phase), _mm_mul_ps(fi, _mm_set1_ps(inc)));
+        p = _mm_sub_ps(p, oscFloorSSE2(p));
+        __m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(fi, _mm_set1_ps(step)));
+        __m128 o = _mm_loadu_ps(out + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(o, _mm_mul_ps(g, oscWaveSSE2<W>(p))));
+    }
+    oscRampScalarFrom<W>(i, out, frames, phase, inc, gain, step);
+}
+
+// AVX2 + FMA
+
+template<Waveform W>
+LD_TARGET_AVX2 inline __m256 oscWaveAVX2(__m256 p) {
+    if constexpr (W == Waveform::Sine) {
+        __m256 x = _mm256_sub_ps(p, _mm256_set1_ps(0.5f));
+        x = _mm256_min_ps(x, _mm256_sub_ps(_mm256_set1_ps(0.5f), x));
+        x = _mm256_max_ps(x, _mm256_sub_ps(_mm256_set1_ps(-0.5f), x));
+        x = _mm256_mul_ps(x, _mm256_set1_ps(OSC_TWO_PI));
+        __m256 x2 = _mm256_mul_ps(x, x);
+        __m256 s = _mm256_set1_ps(OSC_SIN_C11);
+        s = _mm256_fmadd_ps(s, x2, _mm256_set1_ps(OSC_SIN_C9));
+        s = _mm256_fmadd_ps(s, x2, _mm256_set1_ps(OSC_SIN_C7));
+        s = _mm256_fmadd_ps(s, x2, _mm256_set1_ps(OSC_SIN_C5));
+        s = _mm256_fmadd_ps(s, x2, _mm256_set1_ps(OSC_SIN_C3));
+        s = _mm256_fmadd_ps(s, x2, _mm256_set1_ps(1.0f));
+        return _mm256_mul_ps(s, _mm256_sub_ps(_mm256_setzero_ps(), x));
+    } else if constexpr (W == Waveform::Square) {
+        __m256 mask = _mm256_cmp_ps(p, _mm256_set1_ps(0.5f), _CMP_LT_OQ);
+        return _mm256_blendv_ps(_mm256_set1_ps(-1.0f), _mm256_set1_ps(1.0f), mask);
+    } else {
+        __m256 saw = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_sub_ps(p, _mm256_floor_ps(_mm256_add_ps(p, _mm256_set1_ps(0.5f)))));
+        if constexpr (W == Waveform::Triangle) {
+            __m256 abs = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), saw);
+            return _mm256_fmsub_ps(_mm256_set1_ps(2.0f), abs, _mm256_set1_ps(1.0f));
+        } else {
+            return saw;
+        }
+    }
+}
+
+template<Waveform W>
+LD_TARGET_AVX2 void oscRampAVX2(float* out, size_t frames, float phase, float inc, float gain, float step) {
+    __m256 index = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 fi = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), index);
+        __m256 p = _mm256_add_ps(_mm256_set1_ps(phase), _mm256_mul_ps(fi, _mm256_set1_ps(inc))); // not fused, as the scalar kernel
+        p = _mm256_sub_ps(p, _mm256_floor_ps(p));
+        __m256 g = _mm256_fmadd_ps(fi, _mm256_set1_ps(step), _mm256_set1_ps(gain));
+        __m256 o = _mm256_loadu_ps(out + i);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(g, oscWaveAVX2<W>(p), o));
+    }
+    oscRampScalarFrom<W>(i, out, frames, phase, inc, gain, step);
+}
+
+// AVX-512
+
+// gcc's avx512 headers start from _mm512_undefined_ps(), which -Wmaybe-uninitialized reports on every use
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template<Waveform W>
+LD_TARGET_AVX512 inline __m512 oscWaveAVX512(__m512 p) {
+    if constexpr (W == Waveform::Sine) {
+        __m512 x = _mm512_sub_ps(p, _mm512_set1_ps(0.5f));
+        x = _mm512_min_ps(x, _mm512_sub_ps(_mm512_set1_ps(0.5f), x));
+        x = _mm512_max_ps(x, _mm512_sub_ps(_mm512_set1_ps(-0.5f), x));
+        x = _mm512_mul_ps(x, _mm512_set1_ps(OSC_TWO_PI));
+        __m512 x2 = _mm512_mul_ps(x, x);
+        __m512 s = _mm512_set1_ps(OSC_SIN_C11);
+        s = _mm512_fmadd_ps(s, x2, _mm512_set1_ps(OSC_SIN_C9));
+        s = _mm512_fmadd_ps(s, x2, _mm512_set1_ps(OSC_SIN_C7));
+        s = _mm512_fmadd_ps(s, x2, _mm512_set1_ps(OSC_SIN_C5));
+        s = _mm512_fmadd_ps(s, x2, _mm512_set1_ps(OSC_SIN_C3));
+        s = _mm512_fmadd_ps(s, x2, _mm512_set1_ps(1.0f));
+        return _mm512_mul_ps(s, _mm512_sub_ps(_mm512_setzero_ps(), x));
+    } else if constexpr (W == Waveform::Square) {
+        __mmask16 mask = _mm512_cmp_ps_mask(p, _mm512_set1_ps(0.5f), _CMP_LT_OQ);
+        return _mm512_mask_blend_ps(mask, _mm512_set1_ps(-1.0f), _mm512_set1_ps(1.0f));
+    } else {
+        __m512 floor = _mm512_roundscale_ps(_mm512_add_ps(p, _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 saw = _mm512_mul_ps(_mm512_set1_ps(2.0f), _mm512_sub_ps(p, floor));
+        if constexpr (W == Waveform::Triangle) {
+            return _mm512_fmsub_ps(_mm512_set1_ps(2.0f), _mm512_abs_ps(saw), _mm512_set1_ps(1.0f));
+        } else {
+            return saw;
+        }
+    }
+}
+
+template<Waveform W>
+LD_TARGET_AVX512 void oscRampAVX512(float* out, size_t frames, float phase, float inc, float gain, float step) {
+    __m512 index = _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    for (size_t i = 0; i < frames; i += 16) {
+        // the tail is done with a masked load/store instead of a scalar loop
+        __mmask16 mask = frames - i >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (frames - i)) - 1);
+        __m512 fi = _mm512_add_ps(_mm512_set1_ps(static_cast<float>(i)), index);
+        __m512 p = _mm512_add_ps(_mm512_set1_ps(phase), _mm512_mul_ps(fi, _mm512_set1_ps(inc))); // not fused, as the scalar kernel
+        p = _mm512_sub_ps(p, _mm512_roundscale_ps(p, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+        __m512 g = _mm512_fmadd_ps(fi, _mm512_set1_ps(step), _mm512_set1_ps(gain));
+        __m512 o = _mm512_maskz_loadu_ps(mask, out + i);
+        _mm512_mask_storeu_ps(out + i, mask, _mm512_fmadd_ps(g, oscWaveAVX512<W>(p), o));
+    }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // LD_SIMD_X86
+
+template<Waveform W>
+inline OscKernel oscKernelFor(SimdLevel level) {
+    switch (level) {
+#ifdef LD_SIMD_X86
+        case SimdLevel::AVX512:
+            return oscRampAVX512<W>;
+        case SimdLevel::AVX2:
+            return oscRampAVX2<W>;
+        case SimdLevel::SSE2:
+            return oscRampSSE2<W>;
+#endif
+        default:
+            return oscRampScalar<W>;
+    }
+}
+
+inline OscKernel oscKernel(Waveform wave, SimdLevel level = simdLevel()) {
+    switch (wave) {
+        case Waveform::Sine:
+            return oscKernelFor<Waveform::Sine>(level);
+        case Waveform::Triangle:
+            return oscKernelFor<Waveform::Triangle>(level);
+        case Waveform::Square:
+            return oscKernelFor<Waveform::Square>(level);
+        case Waveform::Saw:
+            return oscKernelFor<Waveform::Saw>(level);
+    }
+    return oscRampScalar<Waveform::Sine>;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "bufferpool.h"
+#include "dsp.h"
+#include "silence.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// C++17 basic LightDaw paged sample buffer
+// a long mix as one vector has to be copied every time it grows, on a long song that is hundreds of megabytes at a time.
+// a PagedBuffer keeps the samples in fixed size pages instead: growing only adds pages (the table of pointers is all that moves),
+// and a page is only allocated when something audible is written to it, pages nobody wrote to read as silence and cost nothing.
+// the pages come from bufferPool(), so they are 64 byte aligned and reused between mixes
+
+#define PAGED_BUFFER_PAGE 16384 // samples, 64 KB, a power of two
+
+struct PagedBuffer {
+    std::vector<float*> pages; // nullptr for a page that is silent
+    size_t length = 0; // in samples
+
+    PagedBuffer() = default;
+
+    explicit PagedBuffer(size_t frames) {
+        resize(frames);
+    }
+
+    PagedBuffer(const PagedBuffer& other) {
+        *this = other;
+    }
+
+    PagedBuffer(PagedBuffer&& other) noexcept : pages(std::move(other.pages)), length(other.length) {
+        other.pages.clear();
+        other.length = 0;
+    }
+
+    PagedBuffer& operator=(const PagedBuffer& other) {
+        if (this == &other) return *this;
+        clear();
+        resize(other.length);
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (other.pages[i] != nullptr) {
+                std::memcpy(page(i), other.pages[i], PAGED_BUFFER_PAGE * sizeof(float));
+            }
+        }
+        return *this;
+    }
+
+    PagedBuffer& operator=(PagedBuffer&& other) noexcept {
+        if (this == &other) return *this;
+        clear();
+        pages = std::move(other.pages);
+        length = other.length;
+        other.pages.clear();
+        other.length = 0;
+        return *this;
+    }
+
+    ~PagedBuffer() {
+        clear();
+    }
+
+    [[nodiscard]] size_t size() const {
+        return length;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return length == 0;
+    }
+
+    [[nodiscard]] size_t pageCount() const {
+        return pages.size();
+    }
+
+    [[nodiscard]] size_t allocatedPages() const {
+        return static_cast<size_t>(std::count_if(pages.begin(), pages.end(), [](const float* p) { return p != nullptr; }));
+    }
+
+    // nullptr when the page is silent
+    [[nodiscard]] const float* pageData(size_t index) const {
+        return pages[index];
+    }
+
+    // room in the page table for `frames` samples, when the length is known up front
+    void reserve(size_t frames) {
+        pages.reserve(pagesFor(frames));
+    }
+
+    // new samples are silent, shrinking frees the pages past the end
+    void resize(size_t frames) {
+        size_t count = pagesFor(frames);
+        for (size_t i = count; i < pages.size(); i++) {
+            freePage(pages[i]);
+        }
+        if (frames < length && count > 0 && pages[count - 1] != nullptr) {
+            size_t used = frames - (count - 1) * PAGED_BUFFER_PAGE;
+            std::fill(pages[count - 1] + used, pages[count - 1] + PAGED_BUFFER_PAGE, 0.0f); // growing again has to read silence
+        }
+        pages.resize(count, nullptr);
+        length = frames;
+    }
+
+    void clear() {
+        for (float* p : pages) {
+            freePage(p);
+        }
+        pages.clear();
+        length = 0;
+    }
+
+    [[nodiscard]] float operator[](size_t index) const {
+        const float* p = pages[index / PAGED_BUFFER_PAGE];
+        return p != nullptr ? p[index % PAGED_BUFFER_PAGE] : 0.0f;
+    }
+
+    // calls f(first sample, frames, samples already done) for every page overlapping [position, position + frames)
+    template<typename F>
+    void forEachSpan(size_t position, size_t frames, F&& f) const {
+        size_t done = 0;
+        while (done < frames) {
+            size_t at = position + done;
+            size_t count = std::min(frames - done, PAGED_BUFFER_PAGE - at % PAGED_BUFFER_PAGE);
+            f(at, count, done);
+            done += count;
+        }
+    }
+
+    // out += in * gain, grows the buffer when needed
+    void mix(size_t position, const float* in, size_t frames, float gain = 1.0f) {
+        if (position + frames > length) resize(position + frames);
+        forEachSpan(position, frames, [&](size_t at, size_t count, size_t done) {
+            dspMix(samples(at), in + done, count, gain);
+        });
+    }
+
+    // overwrite, silence written to a silent page doesn't allocate it
+    void write(size_t position, const float* in, size_t frames) {
+        if (position + frames > length) resize(position + frames);
+        forEachSpan(position, frames, [&](size_t at, size_t count, size_t done) {
+            if (pages[at / PAGED_BUFFER_PAGE] == nullptr && dspPeak(in + done, count) == 0.0f) return;
+            std::memcpy(samples(at), in + done, count * sizeof(float));
+        });
+    }
+
+    // let `fill` add into the buffer directly, fill(float* out, size_t frames, size_t done) is called once per page it overlaps
+    template<typename F>
+    void fill(size_t position, size_t frames, F&& f) {
+        if (position + frames > length) resize(position + frames);
+        forEachSpan(position, frames, [&](size_t at, size_t count, size_t done) {
+            f(samples(at), count, done);
+        });
+    }
+
+    // out += the samples, silent pages are skipped
+    void mixInto(float* out, size_t position, size_t frames, float gain = 1.0f) const {
+        size_t inside = position < length ? std::min(frames, length - position) : 0;
+        forEachSpan(position, inside, [&](size_t at, size_t count, size_t done) {
+            const float* p = pages[at / PAGED_BUFFER_PAGE];
+            if (p != nullptr) dspMix(out + done, p + at % PAGED_BUFFER_PAGE, count, gain);
+        });
+    }
+
+    // which blocks are silent, pages that were never written aren't even read
+    [[nodiscard]] SilenceMap silence(float threshold = SILENCE_THRESHOLD) const {
+        SilenceMap map(length);
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (pages[i] == nullptr) continue;
+            size_t pageEnd = std::min(length, (i + 1) * PAGED_BUFFER_PAGE);
+            for (size_t at = i * PAGED_BUFFER_PAGE; at < pageEnd; at += SILENCE_BLOCK) {
+                map.mark(at / SILENCE_BLOCK, ::isSilent(pages[i] + at % PAGED_BUFFER_PAGE, std::min<size_t>(SILENCE_BLOCK, pageEnd - at), threshold));
+            }
+        }
+        return map;
+    }
+
+    // copy out, anything past the end reads as silence
+    void read(size_t position, float* out, size_t frames) const {
+        size_t inside = position < length ? std::min(frames, length - position) : 0;
+        forEachSpan(position, inside, [&](size_t at, size_t count, size_t done) {
+            const float* p = pages[at / PAGED_BUFFER_PAGE];
+            if (p != nullptr) {
+                std::memcpy(out + done, p + at % PAGED_BUFFER_PAGE, count * sizeof(float));
+            } else {
+                std::fill(out + done, out + done + count, 0.0f);
+            }
+        });
+        std::fill(out + inside, out + frames, 0.0f);
+    }
+
+private:
+    static size_t pagesFor(size_t frames) {
+        return (frames + PAGED_BUFFER_PAGE - 1) / PAGED_BUFFER_PAGE;
+    }
+
+    // the page is allocated (silent) on first use
+    float* page(size_t index) {
+        if (pages[index] == nullptr) {
+            pages[index] = static_cast<float*>(bufferPool().allocate(PAGED_BUFFER_PAGE * sizeof(float)));
+            std::fill(pages[index], pages[index] + PAGED_BUFFER_PAGE, 0.0f);
+        }
+        return pages[index];
+    }
+
+    float* samples(size_t position) {
+        return page(position / PAGED_BUFFER_PAGE) + position % PAGED_BUFFER_PAGE;
+    }
+
+    static void freePage(float* p) {
+        if (p != nullptr) bufferPool().deallocate(p, PAGED_BUFFER_PAGE * sizeof(float));
+    }
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "audio.h"
+#include "instrument.h"
+#include "ldp.h"
+#include "notetable.h"
+#include "render.h"
+#include "string.h"
+#include "synth.h"
+#include "threadpool.h"
+#include "wavload.h"
+#include <MidiFile.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// C++17 basic LightDaw project
+// everything about a project that doesn't need a window: loading it from an archive, turning the instruments into real ones,
+// finding the (midi, instrument) pairs to render, and rendering it offline. the gui (LightDawState in main.cpp) builds on
+// ProjectData, and so does the command line renderer (ldrender.cpp), which is built with LD_HEADLESS and without any gui library
+
+#define PROJECT_ALL_PATTERNS SIZE_MAX // render every pattern, not only one
+
+struct ProjectData {
+    std::unordered_map<uint64_t, LdifFile> instruments{};
+    std::unordered_map<uint64_t, Instrument*> realInstruments{}; // should be one for each instrument
+    std::vector<LdpfFile> patterns{};
+    std::unordered_map<uint64_t, MidiClip> midis{}; // the notes are compiled once, when the midi is loaded
+
+    LdipFile project{};
+
+    std::vector<std::string> error_queue; // when an error happens, it will be added to this queue
+    // in the main loop, it will be displayed with a modal popup.
+    // if multiple, they will be displayed in a list, but most of the time it will just be one error.
+
+    uint64_t addInstrument(const LdifFile &instrument) {
+        FileID id = FileID(instrument.toBytes());
+        instruments[id.id] = instrument;
+        return id.id;
+    }
+
+    // the archive can throw (std::runtime_error) when it is damaged, see ArchiveFile::fromBytes
+    void load(const ArchiveFile &archive) {
+        for (const auto &key: archive.getFileNames()) {
+            if (ends_with(key, ".ldif")) {
+                ByteBuffer buffer = archive.getFile(key).data;
+                LdifFile instrument = LdifFile::fromBytes(buffer);
+                instruments[FileID::fromFilename(key).id] = instrument;
+            } else if (ends_with(key, ".ldpf")) {
+                ByteBuffer buffer = archive.getFile(key).data;
+                LdpfFile pattern = LdpfFile::fromBytes(buffer);
+                patterns.push_back(pattern);
+            } else if (ends_with(key, ".mid")) {
+                ByteBuffer buffer = archive.getFile(key).data;
+                // midiFile uses a stream, so we need to copy the buffer into a stream
+                std::stringstream stream;
+                for (uint8_t byte: buffer) {
+                    stream << byte;
+                }
+                smf::MidiFile midi;
+                midi.read(stream);
+
+                midis[FileID::fromFilename(key).id] = MidiClip(midi);
+            } else if (ends_with(key, ".ldip")) {
+                ByteBuffer buffer = archive.getFile(key).data;
+                project = LdipFile::fromBytes(buffer);
+            } else {
+                std::cerr << "Error: Unknown file type: " << key << std::endl;
+                error_queue.push_back("Failed to load project:\nUnknown file type: " + key);
+            }
+        }
+        createRealInstruments();
+    }
+
+    void createRealInstruments() {
+        for (auto &[id, instrument]: instruments) {
+            if (realInstruments.find(id) == realInstruments.end()) {
+                if (instrument.flags == LdifFile::FLAGS_SYNTH) { // 0x25c2230 sqr  0x25cc9a0 sin
+                    realInstruments[id] = new SynthInstrument(createSynth(instrument.id.id));
+                    if (realInstruments[id] == nullptr) {
+                        std::cerr << "Error: Failed to create synth" << std::endl;
+                        error_queue.emplace_back("Error: Failed to create synth");
+                    } else if (dynamic_cast<SynthInstrument *>(realInstruments[id]) == nullptr) {
+                        std::cerr << "Error: Failed to create synth" << std::endl;
+                        error_queue.emplace_back("Error: Failed to create synth");
+                    } else if (dynamic_cast<SynthInstrument *>(realInstruments[id])->synth == nullptr) {
+                        std::cerr << "Error: Failed to create synth" << std::endl;
+                        error_queue.emplace_back("Error: Failed to create synth");
+                    }
+                    DeserializeResult x = realInstruments[id]->deserializeParams(instrument.instrumentData);
+                    if (x == DeserializeResult::Failure) {
+                        // we assume it's our fault (the data we gave was wrong)
+                        // so we will recreate the synth (to get the default values) and serialize it
+                        // then we will save the new data
+                        std::cerr << "Error: Failed to deserialize synth parameters" << std::endl;
+                        delete realInstruments[id];
+                        realInstruments[id] = new SynthInstrument(createSynth(instrument.id.id));
+                        instrument.instrumentData = realInstruments[id]->serializeParams();
+
+                    }
+                } else {
+                    std::cerr << "Error: Instrument is not a synth" << std::endl;
+                    error_queue.emplace_back("Error: Instrument is not a synth:\nExternal instruments are not supported in this version!");
+                    // TODO
+                }
+            }
+        }
+    }
+
+    // nullptr when the instrument has no real instrument (it isn't a synth, or it isn't in the project)
+    [[nodiscard]] Instrument *realInstrument(uint64_t instrumentID) const {
+        auto it = realInstruments.find(instrumentID);
+        return it != realInstruments.end() ? it->second : nullptr;
+    }
+
+    // what the stem of a pair is cached under, it changes whenever anything that is heard in the stem changes.
+    // instrument is the real instrument of instrumentID
+    static StemKey stemKey(uint64_t midiID, uint64_t instrumentID, Instrument &instrument) {
+        ByteBuffer params = instrument.serializeParams();
+        Writer(params, params.size()).writeFloat32(instrument.volume); // the volume knob isn't part of the params, but it changes the stem
+        return {midiID, instrumentID, hash64(params), SAMPLE_RATE};
+    }
+
+    // the (midi, instrument) pairs of one pattern, or of every pattern (PROJECT_ALL_PATTERNS), in the order they are mixed
+    // pairs that can't be rendered (a missing midi or instrument, or an instrument that isn't a synth) are reported and left out
+    std::vector<std::pair<uint64_t, uint64_t>> renderPairs(size_t pattern = PROJECT_ALL_PATTERNS) {
+        std::vector<std::pair<uint64_t, uint64_t>> pairs;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (pattern != PROJECT_ALL_PATTERNS && i != pattern) continue;
+            for (const auto &[midifileID, instrumentfileID]: patterns[i].pairs) {
+                if (midis.find(midifileID.id) == midis.end()) {
+                    std::cerr << "Error: Midi file not found" << std::endl;
+                    error_queue.emplace_back("Error: Midi not found!");
+                    continue;
+                }
+                if (instruments.find(instrumentfileID.id) == instruments.end()) {
+                    std::cerr << "Error: Instrument file not found" << std::endl;
+                    error_queue.emplace_back("Error: Instrument not found!");
+                    continue;
+                }
+                LdifFile instrument = instruments[instrumentfileID.id];
+                if (instrument.flags == LdifFile::FLAGS_SYNTH && realInstrument(instrumentfileID.id) != nullptr) {
+                    pairs.emplace_back(midifileID.id, instrumentfileID.id);
+                } else {
+                    std::cerr << "Error: Instrument is not a synth" << std::endl;
+                    error_queue.emplace_back("Error: Instrument is not a synth:\nExternal instruments are not supported in this version!");
+                    // TODO
+                }
+            }
+        }
+        return pairs;
+    }
+};
+
+// what an offline render did, for --stats in ldrender
+struct OfflineRenderStats {
+    size_t pairs = 0;
+    size_t notes = 0;
+    size_t frames = 0; // length of the result
+    size_t threads = 0;
+    double renderSeconds = 0; // stems, on the thread pool
+    double mixSeconds = 0;
+    double limitSeconds = 0;
+    size_t cachedStems = 0; // found in the render cache, not rendered again
+    size_t blocks = 0; // SILENCE_BLOCKs over every stem
+    size_t silentBlocks = 0;
+    size_t stemBytes = 0; // what the stems took up, silent pages aren't allocated
+    size_t mixPages = 0; // pages of the mix that had to be allocated
+    float peak = 0.0f; // after the limiter
+
+    [[nodiscard]] double totalSeconds() const {
+        return renderSeconds + mixSeconds + limitSeconds;
+    }
+
+    // how many seconds of audio were rendered per second, above 1 is faster than real time
+    [[nodiscard]] double speed() const {
+        double total = totalSeconds();
+        return total > 0 ? static_cast<double>(frames) / SAMPLE_RATE / total : 0.0;
+    }
+};
+
+struct OfflineRenderOptions {
+    size_t pattern = PROJECT_ALL_PATTERNS;
+    size_t from = 0; // in samples
+    size_t to = SIZE_MAX; // in samples, the end of the song at most
+    size_t threads = std::thread::hardware_concurrency();
+    float ceilingDb = LIMITER_CEILING_DB;
+    float releaseMs = LIMITER_RELEASE_MS;
+};
+
+// a stem of an offline render, either the whole stem of the pair (from the render cache) or only the part in the range
+struct OfflineStem {
+    Stem stem;
+    size_t start = 0; // where the first sample of the stem is on the timeline
+};
+
+// renders the stem of every pair on `pool`, in pair order, and blocks until they are done.
+// every stem gets its own copy of the instrument, two pairs with the same instrument can render at the same time.
+// with a cache, stems that were already rendered are taken from it (and cut to the range when mixing), whole stems that
+// had to be rendered are added to it. `cached` can hold whole stems (by pair) that were taken from the cache earlier, those are
+// used even if the cache dropped them since. the pool can be shared with other renders, only this render's stems are waited for
+inline std::vector<OfflineStem> renderOfflineStems(ProjectData& data, const std::vector<std::pair<uint64_t, uint64_t>>& pairs, const OfflineRenderOptions& options, OfflineRenderStats& stats, ThreadPool& pool, RenderCache* cache = nullptr, const std::vector<Stem>& cached = {}) {
+    using Clock = std::chrono::steady_clock;
+    stats.pairs = pairs.size();
+    stats.threads = pool.size();
+
+    std::vector<std::unique_ptr<Instrument>> instruments;
+    std::vector<NoteTableRef> notes;
+    std::vector<StemKey> keys;
+    std::vector<OfflineStem> stems(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        const auto &[midi, instrument] = pairs[i];
+        Instrument &real = *data.realInstruments.at(instrument); // the pairs come from renderPairs, so both are there
+        instruments.emplace_back(real.clone());
+        notes.push_back(data.midis.at(midi).notes);
+        stats.notes += notes.back()->size();
+        if (i < cached.size() && cached[i] != nullptr) {
+            stems[i] = {cached[i], 0};
+            stats.cachedStems++;
+        }
+        if (cache != nullptr) {
+            keys.push_back(ProjectData::stemKey(midi, instrument, real));
+            if (stems[i].stem != nullptr) continue;
+            if (Stem stem = cache->find(keys.back())) {
+                stems[i] = {std::move(stem), 0};
+                stats.cachedStems++;
+            }
+        }
+    }
+    Clock::time_point start = Clock::now();
+    {
+        TaskGroup group(pool);
+        for (size_t i = 0; i < pairs.size(); i++) {
+            if (stems[i].stem != nullptr) continue;
+            group.submit([&, i] {
+                auto stem = std::make_shared<const RenderedStem>(renderStem(instruments[i].get(), notes[i], nullptr, SILENCE_THRESHOLD, options.from, options.to));
+                bool whole = options.from == 0 && options.to >= stemLength(instruments[i].get(), *notes[i]);
+                if (cache != nullptr && whole) {
+                    cache->insert(keys[i], stem);
+                }
+                stems[i] = {std::move(stem), options.from};
+            });
+        }
+        group.wait();
+    }
+    stats.renderSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (const OfflineStem &stem: stems) {
+        stats.blocks += stem.stem->silence.blocks();
+        stats.silentBlocks += stem.stem->silence.silentBlocks();
+        stats.stemBytes += stem.stem->bytes();
+    }
+    return stems;
+}
+
+// how long the mix of the stems is, from options.from to where the last stem ends (options.to at most)
+inline size_t offlineLength(const std::vector<OfflineStem>& stems, const OfflineRenderOptions& options) {
+    size_t end = options.from;
+    for (const OfflineStem &stem: stems) {
+        end = std::max(end, std::min(stem.start + stem.stem->size(), options.to));
+    }
+    return end - options.from;
+}
+
+// sums the part of the stems in [options.from, options.from + frames) into a stream of `frames` samples, not limited.
+// silent blocks of the stems are never read, and pages of the mix that only silence would go to are never allocated
+inline AudioStream mixOffline(const std::vector<OfflineStem>& stems, const OfflineRenderOptions& options, size_t frames) {
+    AudioStream stream(frames);
+    for (const OfflineStem &stem: stems) {
+        size_t first = std::max(options.from, stem.start);
+        size_t last = std::min(options.from + frames, stem.start + stem.stem->size());
+        if (first >= last) continue;
+        stem.stem->silence.forEachSound(first - stem.start, last - first, [&](size_t at, size_t count) {
+            size_t position = at + stem.start - options.from;
+            stream.write(count, AudioOffset::fromSamples(position), [&](float* out, size_t n, size_t done) {
+                stem.stem->samples.mixInto(out, at + done, n);
+            });
+        });
+    }
+    return stream;
+}
+
+// the highest sample of the stream, silent pages aren't read
+inline float streamPeak(const AudioStream& stream) {
+    float peak = 0.0f;
+    for (size_t i = 0; i < stream.buffer.pageCount(); i++) {
+        if (const float* page = stream.buffer.pageData(i)) {
+            peak = std::max(peak, dspPeak(page, std::min<size_t>(PAGED_BUFFER_PAGE, stream.size() - i * PAGED_BUFFER_PAGE)));
+        }
+    }
+    return peak;
+}
+
+// renders [options.from, options.to) of the pairs into a stream, as fast as the machine can.
+// every pair is rendered to a stem on the pool (like the player's StemNodes, but without playing anything live),
+// then the stems are mixed in pair order and the mix goes through the same limiter the output uses.
+// silent blocks are skipped everywhere, so a sparse song costs much less than its length
+inline AudioStream renderOffline(ProjectData& data, const std::vector<std::pair<uint64_t, uint64_t>>& pairs, const OfflineRenderOptions& options, OfflineRenderStats& stats, ThreadPool& pool, RenderCache* cache = nullptr, const std::vector<Stem>& cached = {}) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<OfflineStem> stems = renderOfflineStems(data, pairs, options, stats, pool, cache, cached);
+    Clock::time_point rendered = Clock::now();
+
+    AudioStream stream = mixOffline(stems, options, offlineLength(stems, options));
+    stems.clear(); // the stems aren't needed anymore, cached ones stay in the cache
+    Clock::time_point mixed = Clock::now();
+
+    stream.limit(options.ceilingDb, options.releaseMs);
+    Clock::time_point limited = Clock::now();
+
+    stats.frames = stream.size();
+    stats.mixPages = stream.buffer.allocatedPages();
+    stats.peak = streamPeak(stream);
+    stats.mixSeconds = std::chrono::duration<double>(mixed - rendered).count();
+    stats.limitSeconds = std::chrono::duration<double>(limited - mixed).count();
+    return stream;
+}
+
+// the pairs of options.pattern on a pool of options.threads threads, without a cache
+inline AudioStream renderOffline(ProjectData& data, const OfflineRenderOptions& options, OfflineRenderStats& stats) {
+    std::vector<std::pair<uint64_t, uint64_t>> pairs = data.renderPairs(options.pattern);
+    ThreadPool pool(std::max<size_t>(options.threads, 1));
+    return renderOffline(data, pairs, options, stats, pool);
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define LD_RT_X86 1
+#endif
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// C++17 basic LightDaw real time thread setup
+// things the audio thread (and the render workers that feed it) can do once so they don't get slow later on:
+// flush denormals to zero (decaying filters, envelopes and reverbs end up in denormals, which can be 100x slower on x86),
+// lock their memory so it can't be paged out, touch it so the first use doesn't page fault, and ask for a real time priority.
+// every step can fail (no permission, unsupported platform), that is never an error, it is reported in realtimeStatus()
+
+#define RT_AUDIO_PRIORITY 80 // SCHED_FIFO priority of the audio thread, clamped to what the system allows
+#define RT_RENDER_PRIORITY 70 // render workers, below the audio thread so they can't starve it
+#define RT_PAGE_SIZE 4096
+
+enum class RealtimeResult : int {
+    Off, // not tried, real time mode is off or the thread didn't run yet
+    Failed,
+    Done
+};
+
+inline const char* realtimeResultName(RealtimeResult result) {
+    switch (result) {
+        case RealtimeResult::Off: return "off";
+        case RealtimeResult::Failed: return "failed";
+        case RealtimeResult::Done: return "done";
+    }
+    return "unknown";
+}
+
+// what real time mode achieved, written by the threads that did the setup
+struct RealtimeStatus {
+    std::atomic<RealtimeResult> audioDenormals{RealtimeResult::Off};
+    std::atomic<RealtimeResult> audioPriority{RealtimeResult::Off};
+    std::atomic<RealtimeResult> renderDenormals{RealtimeResult::Off};
+    std::atomic<RealtimeResult> renderPriority{RealtimeResult::Off};
+    std::atomic<RealtimeResult> lockAll{RealtimeResult::Off}; // mlockall, every page of the process
+    std::atomic<size_t> processLockedBytes{0}; // what the system said was locked right after mlockall (VmLck on linux)
+    std::atomic<size_t> lockedBytes{0}; // locked by objects themselves right now (see lockMemory)
+    std::atomic<size_t> unlockedBytes{0}; // memory that should have been locked but couldn't be
+    std::atomic<size_t> prefaultedBytes{0};
+
+    [[nodiscard]] std::string describe() const {
+        std::stringstream text;
+        text << "audio thread: denormals " << realtimeResultName(audioDenormals.load()) << ", priority " << realtimeResultName(audioPriority.load())
+             << "; render threads: denormals " << realtimeResultName(renderDenormals.load()) << ", priority " << realtimeResultName(renderPriority.load())
+             << "; memory: mlockall " << realtimeResultName(lockAll.load());
+        if (lockAll.load() == RealtimeResult::Done) {
+            text << " (" << processLockedBytes.load() / 1024 << " KB locked then, and everything allocated since)";
+        }
+        text << ", objects " << lockedBytes.load() / 1024 << " KB locked, " << unlockedBytes.load() / 1024 << " KB not locked, "
+             << prefaultedBytes.load() / 1024 << " KB prefaulted";
+        return text.str();
+    }
+};
+
+inline RealtimeStatus& realtimeStatus() {
+    static RealtimeStatus status;
+    return status;
+}
+
+// for the calling thread only, the flags are per thread
+inline bool disableDenormals() {
+#if defined(LD_RT_X86)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ (bit 15) and DAZ (bit 6)
+    return (_mm_getcsr() & 0x8040) == 0x8040;
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    fpcr |= (1ull << 24); // FZ, arm has no separate flag for inputs
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+    return true;
+#else
+    return false;
+#endif
+}
+
+// for the calling thread only. needs CAP_SYS_NICE or an rtprio limit on linux, on windows this is the highest normal priority
+inline bool raiseThreadPriority(int priority) {
+#if defined(_WIN32)
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+    sched_param param{};
+    int lowest = sched_get_priority_min(SCHED_FIFO);
+    int highest = sched_get_priority_max(SCHED_FIFO);
+    param.sched_priority = priority < lowest ? lowest : priority > highest ? highest : priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+// locked pages aren't counted by the system, one munlock unlocks a page for everybody that locked something on it.
+// so every page remembers how many lockMemory calls cover it and is only unlocked when the last of them is undone.
+// while everything is locked (lockAllMemory) the counts are still kept but nothing has to be locked page by page
+struct MemoryLocks {
+    std::mutex mutex;
+    std::map<uintptr_t, size_t> pages; // page address -> how many locks cover it
+    bool all = false;
+
+    static size_t pageSize() {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        long size = sysconf(_SC_PAGESIZE);
+        return size > 0 ? static_cast<size_t>(size) : RT_PAGE_SIZE;
+#endif
+    }
+
+    static bool lockPages(uintptr_t first, size_t bytes) {
+#if defined(_WIN32)
+        return VirtualLock(reinterpret_cast<void*>(first), bytes) != 0;
+#else
+        return mlock(reinterpret_cast<void*>(first), bytes) == 0;
+#endif
+    }
+
+    static void unlockPages(uintptr_t first, size_t bytes) {
+#if defined(_WIN32)
+        VirtualUnlock(reinterpret_cast<void*>(first), bytes);
+#else
+        munlock(reinterpret_cast<void*>(first), bytes);
+#endif
+    }
+
+    // f(first page, bytes) for every run of neighbouring pages, the pages are sorted
+    template<typename F>
+    static void forEachRun(const std::vector<uintptr_t>& runPages, size_t page, F&& f) {
+        for (size_t i = 0; i < runPages.size();) {
+            size_t j = i + 1;
+            while (j < runPages.size() && runPages[j] == runPages[j - 1] + page) j++;
+            f(runPages[i], (j - i) * page);
+            i = j;
+        }
+    }
+};
+
+inline MemoryLocks& memoryLocks() {
+    static MemoryLocks locks;
+    return locks;
+}
+
+// keep memory in ram, limited by RLIMIT_MEMLOCK on linux and the working set size on windows.
+// every lockMemory has to be undone by an unlockMemory of the same range, pages other locks still cover stay locked
+inline bool lockMemory(const void* memory, size_t bytes) {
+    if (bytes == 0) return true;
+    MemoryLocks& locks = memoryLocks();
+    size_t page = MemoryLocks::pageSize();
+    auto begin = reinterpret_cast<uintptr_t>(memory) / page * page;
+    auto end = reinterpret_cast<uintptr_t>(memory) + bytes;
+    std::lock_guard<std::mutex> lock(locks.mutex);
+    std::vector<uintptr_t> added; // pages nobody locked before
+    for (uintptr_t p = begin; p < end; p += page) {
+        if (locks.pages[p]++ == 0) added.push_back(p);
+    }
+    bool locked = true;
+    if (!locks.all) {
+        MemoryLocks::forEachRun(added, page, [&](uintptr_t first, size_t runBytes) {
+            locked = MemoryLocks::lockPages(first, runBytes) && locked;
+        });
+    }
+    if (locked) {
+        realtimeStatus().lockedBytes.fetch_add(added.size() * page);
+    } else {
+        realtimeStatus().unlockedBytes.fetch_add(bytes);
+    }
+    return locked;
+}
+
+inline void unlockMemory(const void* memory, size_t bytes) {
+    if (bytes == 0) return;
+    MemoryLocks& locks = memoryLocks();
+    size_t page = MemoryLocks::pageSize();
+    auto begin = reinterpret_cast<uintptr_t>(memory) / page * page;
+    auto end = reinterpret_cast<uintptr_t>(memory) + bytes;
+    std::lock_guard<std::mutex> lock(locks.mutex);
+    std::vector<uintptr_t> released; // pages no other lock covers
+    for (uintptr_t p = begin; p < end; p += page) {
+        auto found = locks.pages.find(p);
+        if (found == locks.pages.end()) continue;
+        if (--found->second == 0) {
+            locks.pages.erase(found);
+            released.push_back(p);
+        }
+    }
+    if (!locks.all) {
+        MemoryLocks::forEachRun(released, page, MemoryLocks::unlockPages);
+    }
+    size_t releasedBytes = released.size() * page;
+    size_t current = realtimeStatus().lockedBytes.load();
+    realtimeStatus().lockedBytes.store(current > releasedBytes ? current - releasedBytes : 0);
+}
+
+// how much memory the system says the process has locked, 0 where it can't be asked
+inline size_t processLockedMemory() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmLck:", 0) == 0) {
+            return std::stoull(line.substr(6)) * 1024; // in kB
+        }
+    }
+#endif
+    return 0;
+}
+
+// lock every page the process has and every page it gets from now on: the note tables, voices, instruments, graph nodes,
+// stems and wavetables the callback and the render workers touch, not only the objects that lock themselves.
+// needs a high enough RLIMIT_MEMLOCK (or CAP_IPC_LOCK), false when it isn't possible, then only lockMemory calls lock anything
+inline bool lockAllMemory() {
+    MemoryLocks& locks = memoryLocks();
+    std::lock_guard<std::mutex> lock(locks.mutex);
+    if (locks.all) return true;
+#if defined(_WIN32)
+    realtimeStatus().lockAll.store(RealtimeResult::Failed);
+    return false;
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        realtimeStatus().lockAll.store(RealtimeResult::Failed);
+        return false;
+    }
+    locks.all = true;
+    realtimeStatus().lockAll.store(RealtimeResult::Done);
+    realtimeStatus().processLockedBytes.store(processLockedMemory());
+    return true;
+#endif
+}
+
+// undo lockAllMemory, pages lockMemory calls still cover are locked again
+inline void unlockAllMemory() {
+    MemoryLocks& locks = memoryLocks();
+    std::lock_guard<std::mutex> lock(locks.mutex);
+    if (!locks.all) return;
+#if !defined(_WIN32)
+    munlockall();
+#endif
+    locks.all = false;
+    realtimeStatus().lockAll.store(RealtimeResult::Off);
+    realtimeStatus().processLockedBytes.store(0);
+    std::vector<uintptr_t> held;
+    held.reserve(locks.pages.size());
+    for (const auto& [address, count] : locks.pages) {
+        held.push_back(address);
+    }
+    MemoryLocks::forEachRun(held, MemoryLocks::pageSize(), MemoryLocks::lockPages);
+}
+
+// touch every page so the first real use doesn't fault, the contents don't change
+inline void prefault(void* memory, size_t bytes) {
+    auto* bytePointer = static_cast<volatile unsigned char*>(memory);
+    for (size_t i = 0; i < bytes; i += RT_PAGE_SIZE) {
+        bytePointer[i] = bytePointer[i];
+    }
+    if (bytes > 0) {
+        bytePointer[bytes - 1] = bytePointer[bytes - 1];
+    }
+    realtimeStatus().prefaultedBytes.fetch_add(bytes);
+}
+
+// lock and prefault, what an OutputSource does with its buffers when it joins a real time output
+inline bool prepareMemory(void* memory, size_t bytes) {
+    prefault(memory, bytes);
+    return lockMemory(memory, bytes);
+}
+
+// call on the audio thread itself, before it does anything else
+inline void setupAudioThread() {
+    realtimeStatus().audioDenormals.store(disableDenormals() ? RealtimeResult::Done : RealtimeResult::Failed);
+    realtimeStatus().audioPriority.store(raiseThreadPriority(RT_AUDIO_PRIORITY) ? RealtimeResult::Done : RealtimeResult::Failed);
+}
+
+inline void setupRenderThread() {
+    realtimeStatus().renderDenormals.store(disableDenormals() ? RealtimeResult::Done : RealtimeResult::Failed);
+    realtimeStatus().renderPriority.store(raiseThreadPriority(RT_RENDER_PRIORITY) ? RealtimeResult::Done : RealtimeResult::Failed);
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "audio.h"
+#include "instrument.h"
+#include "threadpool.h"
+#include "rendercache.h"
+#include "notetable.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+// C++17 basic LightDaw streaming render graph
+// instead of rendering the whole song into one AudioStream before playback, the AudioPlayer render worker pulls
+// fixed size blocks from a graph of RenderNodes (see audio.h). every node mixes its output into a block that the caller owns,
+// so memory only depends on the block size and the number of sounding notes, not on the length of the song
+
+// how long the notes last through an instrument, the last note off plus the release
+inline size_t stemLength(const Instrument* instrument, const NoteTable& notes) {
+    size_t length = notes.duration();
+    if (instrument != nullptr && !notes.empty()) {
+        length += instrument->releaseSamples();
+    }
+    return length;
+}
+
+// plays a list of notes through an instrument, this is what a (midi, instrument) pair of a pattern turns into
+// every note gets a voice from a fixed pool, note on and note off happen on the exact sample of the note,
+// and the block is rendered in pieces between those events
+struct NoteSequenceNode : public RenderNode {
+    Instrument* instrument;
+    NoteTableRef notes;
+    VoicePool voices;
+
+    std::vector<size_t> held; // indices of the notes that are between note on and note off
+    std::vector<size_t> sounding; // seek only, the notes that are sounding at the new position
+    size_t nextNote = 0;
+    size_t expectedPosition = 0;
+    size_t totalLength = 0;
+
+    NoteSequenceNode(Instrument* instrument, NoteTableRef notes, size_t voiceCount = DEFAULT_VOICE_COUNT, StealPolicy policy = StealPolicy::Oldest) : instrument(instrument), notes(std::move(notes)), voices(voiceCount, policy) {
+        totalLength = stemLength(instrument, *this->notes);
+        held.reserve(voiceCount);
+        sounding.reserve(this->notes->maxOverlap);
+    }
+
+    void render(float* out, size_t position, size_t frames) override {
+        if (instrument == nullptr) return;
+        if (position != expectedPosition) {
+            seek(position);
+        }
+        size_t end = position + frames;
+        size_t cursor = position;
+        while (cursor < end) {
+            // handle every event on this sample, then render up to the next one
+            const NoteTable& table = *notes;
+            for (size_t i = 0; i < held.size();) {
+                if (table.end(held[i]) <= cursor) {
+                    stop(held[i]);
+                    held[i] = held.back();
+                    held.pop_back();
+                } else {
+                    i++;
+                }
+            }
+            while (nextNote < table.size() && table.start[nextNote] <= cursor) {
+                start(nextNote++, cursor);
+            }
+            size_t next = end;
+            if (nextNote < table.size()) {
+                next = std::min(next, table.start[nextNote]);
+            }
+            for (size_t index : held) {
+                next = std::min(next, table.end(index));
+            }
+            for (Voice& voice : voices.voices) {
+                if (voice.active) {
+                    instrument->processVoice(voice, out + (cursor - position), next - cursor);
+                }
+            }
+            cursor = next;
+        }
+        expectedPosition = end;
+    }
+
+    [[nodiscard]] size_t length() const override {
+        return totalLength;
+    }
+
+private:
+    void start(size_t index, size_t position) {
+        const NoteTable& table = *notes;
+        if (table.end(index) <= position) return;
+        double freq = table.freq[index];
+        instrument->noteOn(freq, table.vol[index]);
+        Voice* voice = voices.noteOn(index, freq, table.vol[index]);
+        if (voice == nullptr) return;
+        // when starting in the middle of a note (after a seek) pick up the phase where it would have been
+        voice->age = position - table.start[index];
+        voice->phase = Oscillator::phaseAt(freq / SAMPLE_RATE, voice->age);
+        if (held.size() == held.capacity()) {
+            // more notes are held than there are voices, so the oldest one has lost its voice to stealing by now
+            auto oldest = std::min_element(held.begin(), held.end(), [&table](size_t x, size_t y) {
+                return table.start[x] < table.start[y];
+            });
+            stop(*oldest);
+            *oldest = index;
+        } else {
+            held.push_back(index);
+        }
+    }
+
+    void stop(size_t index) {
+        instrument->noteOff(notes->freq[index]);
+        voices.noteOff(index);
+    }
+
+    void seek(size_t position) {
+        // notes that started before the new position but are still sounding have to be restarted as well
+        voices.reset();
+        held.clear();
+        // only the notes sounding at the position are looked at, not every note before it
+        sounding.clear();
+        notes->forEachOverlapping(position, position, [this](size_t index) {
+            sounding.push_back(index);
+        });
+        std::sort(sounding.begin(), sounding.end()); // in the order they would have started in
+        for (size_t index : sounding) {
+            start(index, position);
+        }
+        nextNote = std::lower_bound(notes->start.begin(), notes->start.end(), position) - notes->start.begin();
+    }
+};
+
+// renders a whole list of notes into its own buffer, block by block like the player does
+// the result only depends on the instrument and the notes, not on which thread (or how many threads) rendered it
+// returns early (with a partial buffer) when cancel is set
+inline AudioBuffer renderNotes(Instrument* instrument, const NoteTableRef& notes, const std::atomic<bool>* cancel = nullptr) {
+    NoteSequenceNode node(instrument, notes);
+    AudioBuffer buffer(node.length());
+    for (size_t position = 0; position < buffer.size(); position += RENDER_BLOCK_SIZE) {
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) break;
+        size_t frames = std::min<size_t>(RENDER_BLOCK_SIZE, buffer.size() - position);
+        node.render(buffer.data() + position, position, frames);
+    }
+    return buffer;
+}
+
+// like renderNotes, but into a stem that knows which of its blocks are silent, those are left out of the pages entirely
+// only [from, to) of the timeline is rendered (the stem starts at from), notes that are already sounding at from are picked up
+inline RenderedStem renderStem(Instrument* instrument, const NoteTableRef& notes, const std::atomic<bool>* cancel = nullptr, float threshold = SILENCE_THRESHOLD, size_t from = 0, size_t to = SIZE_MAX) {
+    NoteSequenceNode node(instrument, notes);
+    RenderedStem stem;
+    size_t end = std::min(to, node.length());
+    size_t length = end > from ? end - from : 0;
+    stem.samples.resize(length);
+    stem.silence.resize(length);
+    float block[SILENCE_BLOCK];
+    for (size_t position = 0; position < length; position += SILENCE_BLOCK) {
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) break;
+        size_t frames = std::min<size_t>(SILENCE_BLOCK, length - position);
+        std::fill(block, block + frames, 0.0f);
+        node.render(block, from + position, frames);
+        bool silent = isSilent(block, frames, threshold);
+        stem.silence.mark(position / SILENCE_BLOCK, silent);
+        if (!silent) {
+            stem.samples.write(position, block, frames);
+        }
+    }
+    return stem;
+}
+
+// one (midi, instrument) pair of a pattern, rendered to a stem on the render pool
+// playback doesn't wait for it: until the stem is done the notes are played live (with a second copy of the instrument),
+// after that the node only copies from the stem. both copies of the instrument are taken when the node is created,
+// so editing the instrument afterwards never races with the render.
+// a node can also be made from a stem that is already rendered (see rendercache.h), then it only copies
+struct StemNode : public RenderNode {
+    struct Job { // shared with the task, so a node can be dropped while its stem is still rendering
+        std::unique_ptr<Instrument> instrument;
+        NoteTableRef notes;
+        Stem stem;
+        std::atomic<bool> done{false};
+        std::atomic<bool> cancelled{false};
+    };
+
+    std::shared_ptr<Job> job;
+    std::unique_ptr<Instrument> liveInstrument;
+    std::unique_ptr<NoteSequenceNode> live;
+    size_t totalLength = 0;
+
+    // onRendered is called on the worker thread with the finished stem (not when the render was cancelled)
+    StemNode(const Instrument& instrument, NoteTableRef notes, std::function<void(Stem)> onRendered = nullptr, ThreadPool& pool = renderPool()) : job(std::make_shared<Job>()), liveInstrument(instrument.clone()) {
+        live = std::make_unique<NoteSequenceNode>(liveInstrument.get(), notes);
+        totalLength = live->length();
+        job->instrument.reset(instrument.clone());
+        job->notes = std::move(notes);
+        std::shared_ptr<Job> task = job;
+        pool.submit([task, onRendered = std::move(onRendered)] {
+            auto stem = std::make_shared<const RenderedStem>(renderStem(task->instrument.get(), task->notes, &task->cancelled));
+            if (task->cancelled.load(std::memory_order_relaxed)) return;
+            if (onRendered) onRendered(stem);
+            task->stem = std::move(stem);
+            task->done.store(true, std::memory_order_release);
+        });
+    }
+
+    explicit StemNode(Stem stem) : job(std::make_shared<Job>()), totalLength(stem->size()) {
+        job->stem = std::move(stem);
+        job->done.store(true, std::memory_order_release);
+    }
+
+    ~StemNode() override {
+        job->cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool ready() const {
+        return job->done.load(std::memory_order_acquire);
+    }
+
+    void render(float* out, size_t position, size_t frames) override {
+        if (!ready()) {
+            live->render(out, position, frames);
+            return;
+        }
+        job->stem->mixInto(out, position, frames);
+    }
+
+    [[nodiscard]] size_t length() const override {
+        return totalLength;
+    }
+};
+
+// the master of the graph, sums every node into the block. the sum isn't clamped, the output's limiter does that (see limiter.h)
+// the nodes are always summed in the order they were added, so the mix is the same no matter when their stems finished.
+// nodes can only be added while nothing is playing the graph, but they can be replaced at any time (see replace)
+struct RenderGraph : public RenderNode {
+    std::deque<std::atomic<RenderNode*>> nodes; // owned, a deque so adding never moves the atomics
+    std::vector<std::pair<RenderNode*, uint64_t>> retired; // replaced nodes, and how many renders were done when they were replaced
+    std::atomic<uint64_t> renders{0};
+
+    RenderGraph() = default;
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    ~RenderGraph() override {
+        clear();
+    }
+
+    // returns the index of the node, for replace
+    size_t add(RenderNode* node) {
+        nodes.emplace_back(node);
+        return nodes.size() - 1;
+    }
+
+    // swap a node while the graph is playing, the render worker picks up the new one on its next block.
+    // the old node might still be rendering right now, so it is only deleted once a render that started after the swap is done
+    void replace(size_t index, RenderNode* node) {
+        RenderNode* old = nodes[index].exchange(node, std::memory_order_acq_rel);
+        retired.emplace_back(old, renders.load(std::memory_order_acquire));
+        collect();
+    }
+
+    // delete the replaced nodes the render worker is done with, replace already does this, but call it now and then
+    // so the last replaced nodes don't stay around until the graph is cleared
+    void collect() {
+        uint64_t done = renders.load(std::memory_order_acquire);
+        retired.erase(std::remove_if(retired.begin(), retired.end(), [done](const std::pair<RenderNode*, uint64_t>& node) {
+            if (node.second >= done) return false;
+            delete node.first;
+            return true;
+        }), retired.end());
+    }
+
+    // only while nothing is playing the graph
+    void clear() {
+        for (auto& node : nodes) {
+            delete node.load(std::memory_order_relaxed);
+        }
+        nodes.clear();
+        for (auto& node : retired) {
+            delete node.first;
+        }
+        retired.clear();
+    }
+
+    void render(float* out, size_t position, size_t frames) override {
+        for (auto& node : nodes) {
+            node.load(std::memory_order_acquire)->render(out, position, frames);
+        }
+        renders.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    [[nodiscard]] size_t length() const override {
+        size_t len = 0;
+        for (const auto& node : nodes) {
+            len = std::max(len, node.load(std::memory_order_acquire)->length());
+        }
+        return len;
+    }
+};
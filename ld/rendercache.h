@@ -0,0 +1,156 @@
+#pragma once
+
+#include "audio.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// C++17 basic LightDaw render cache
+// a stem only depends on the midi, the instrument and its parameters, and the sample rate. the ids of midis and instruments
+// are already hashes of their contents (see FileID), so together with a hash of serializeParams() they name a stem exactly,
+// and a stem that was rendered once never has to be rendered again while it is in here.
+// the cache has a memory budget, when it is full the stems that were used the longest time ago are dropped first
+
+#define RENDER_CACHE_BUDGET (256 * 1024 * 1024) // bytes, about 25 minutes of stems at 44100 Hz
+
+struct StemKey {
+    uint64_t midi = 0; // FileID of the midi
+    uint64_t instrument = 0; // FileID of the instrument
+    uint64_t params = 0; // hash64 of the instrument's serializeParams()
+    uint32_t sampleRate = SAMPLE_RATE;
+
+    bool operator==(const StemKey& other) const {
+        return midi == other.midi && instrument == other.instrument && params == other.params && sampleRate == other.sampleRate;
+    }
+};
+
+struct StemKeyHash {
+    size_t operator()(const StemKey& key) const {
+        uint64_t hash = key.midi;
+        hash = hash * 31 + key.instrument;
+        hash = hash * 31 + key.params;
+        hash = hash * 31 + key.sampleRate;
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+};
+
+// a rendered (midi, instrument) pair, with which of its blocks are silent (see silence.h)
+// silent blocks are never mixed, and pages that are silent all the way through are never allocated
+struct RenderedStem {
+    PagedBuffer samples;
+    SilenceMap silence;
+
+    [[nodiscard]] size_t size() const {
+        return samples.size();
+    }
+
+    // what the stem really takes up, not its length
+    [[nodiscard]] size_t bytes() const {
+        return samples.allocatedPages() * PAGED_BUFFER_PAGE * sizeof(float) + silence.blocks();
+    }
+
+    // out += the stem from position on, only the blocks that aren't silent are touched
+    void mixInto(float* out, size_t position, size_t frames) const {
+        silence.forEachSound(position, frames, [&](size_t at, size_t count) {
+            samples.mixInto(out + (at - position), at, count);
+        });
+    }
+};
+
+typedef std::shared_ptr<const RenderedStem> Stem; // stems are never changed once rendered, so they can be shared freely
+
+// thread safe, stems are inserted by the render pool and looked up by the ui thread (never use it from the audio thread)
+struct RenderCache {
+    struct Entry {
+        Stem stem;
+        std::list<StemKey>::iterator recent;
+    };
+
+    std::unordered_map<StemKey, Entry, StemKeyHash> entries;
+    std::list<StemKey> recent; // front was used last
+    size_t budget = RENDER_CACHE_BUDGET;
+    size_t used = 0; // bytes
+    size_t hits = 0;
+    size_t misses = 0;
+    mutable std::mutex mutex;
+
+    // nullptr when the stem isn't cached
+    Stem find(const StemKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        recent.splice(recent.begin(), recent, it->second.recent);
+        return it->second.stem;
+    }
+
+    // like find, but doesn't count as a use (or as a hit or miss)
+    [[nodiscard]] bool contains(const StemKey& key) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.find(key) != entries.end();
+    }
+
+    void insert(const StemKey& key, Stem stem) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = stemBytes(stem);
+        if (bytes > budget) return; // it would push out everything else and still not fit
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            used -= stemBytes(it->second.stem);
+            recent.erase(it->second.recent);
+            entries.erase(it);
+        }
+        recent.push_front(key);
+        entries[key] = {std::move(stem), recent.begin()};
+        used += bytes;
+        evict();
+    }
+
+    void setBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        recent.clear();
+        used = 0;
+    }
+
+    [[nodiscard]] size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    [[nodiscard]] size_t usedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+private:
+    static size_t stemBytes(const Stem& stem) {
+        return stem != nullptr ? stem->bytes() : 0;
+    }
+
+    // dropping a stem here never frees it while a StemNode is still playing it, the node holds its own reference
+    void evict() {
+        while (used > budget && !recent.empty()) {
+            auto it = entries.find(recent.back());
+            used -= stemBytes(it->second.stem);
+            entries.erase(it);
+            recent.pop_back();
+        }
+    }
+};
+
+// the cache every render goes through, shared by every project (the keys are content hashes, so they can't collide)
+inline RenderCache& renderCache() {
+    static RenderCache cache;
+    return cache;
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// C++17 basic LightDaw real time safety checker
+// the audio callback (and the render workers feeding it) must never allocate, free or lock a mutex, any of those can block
+// for longer than a buffer lasts. in a build with LD_RT_CHECK (cmake -DLD_RT_CHECK=ON) the allocator and pthread_mutex_lock
+// are interposed, and every call made inside a RealtimeScope is counted and reported on stderr with a stack trace.
+// without LD_RT_CHECK a RealtimeScope is empty and nothing is interposed.
+// on glibc malloc, calloc, realloc, free, the aligned allocations and pthread_mutex_lock are caught, everywhere else only
+// operator new and delete (the plain and nothrow ones). only include this in one translation unit, it defines those functions
+//
+// to check that a component doesn't allocate per block:
+//     RealtimeScope scope("NoteSequenceNode");
+//     node.render(out, position, RENDER_BLOCK_SIZE);
+//     assert(scope.counts().total() == 0);
+// tests/test_rtcheck.cpp does that for the nodes, the limiter, the preview bus and the output callback
+
+struct RtCheckCounts {
+    size_t allocations = 0;
+    size_t frees = 0;
+    size_t locks = 0;
+
+    [[nodiscard]] size_t total() const {
+        return allocations + frees + locks;
+    }
+};
+
+#ifdef LD_RT_CHECK
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#if defined(__GLIBC__)
+#define LD_RT_CHECK_GLIBC 1
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+inline thread_local int rtCheckDepth = 0; // how many RealtimeScopes the thread is in
+inline thread_local const char* rtCheckScopeName = nullptr; // the innermost one
+inline thread_local RtCheckCounts rtCheckThreadCounts;
+inline thread_local bool rtCheckReporting = false; // reporting can allocate itself, that isn't reported again
+inline std::atomic<size_t> rtCheckViolations{0}; // on every thread since the program started
+inline std::atomic<bool> rtCheckPrint{true}; // turn off to only count, in tests that expect violations
+
+inline void rtCheckWrite(const char* text) {
+#if !defined(_WIN32)
+    ssize_t ignored = write(2, text, std::strlen(text)); // not std::cerr, it can allocate and we are inside the allocator
+    (void)ignored;
+#endif
+}
+
+inline void rtCheckViolation(const char* what) {
+    rtCheckViolations.fetch_add(1, std::memory_order_relaxed);
+    if (rtCheckReporting || !rtCheckPrint.load(std::memory_order_relaxed)) return;
+    rtCheckReporting = true;
+    rtCheckWrite("Error: ");
+    rtCheckWrite(what);
+    rtCheckWrite(" in real time scope ");
+    rtCheckWrite(rtCheckScopeName != nullptr ? rtCheckScopeName : "?");
+    rtCheckWrite("\n");
+#ifdef LD_RT_CHECK_GLIBC
+    void* frames[32];
+    int count = backtrace(frames, 32);
+    backtrace_symbols_fd(frames, count, 2);
+#endif
+    rtCheckReporting = false;
+}
+
+inline void rtCheckAllocation() {
+    if (rtCheckDepth == 0) return;
+    rtCheckThreadCounts.allocations++;
+    rtCheckViolation("allocation");
+}
+
+inline void rtCheckFree(void* pointer) {
+    if (rtCheckDepth == 0 || pointer == nullptr) return;
+    rtCheckThreadCounts.frees++;
+    rtCheckViolation("free");
+}
+
+#ifdef LD_RT_CHECK_GLIBC
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void __libc_free(void*);
+void* __libc_memalign(size_t, size_t);
+
+void* malloc(size_t size) {
+    rtCheckAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    rtCheckAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    rtCheckAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    rtCheckFree(pointer);
+    __libc_free(pointer);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    rtCheckAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    rtCheckAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    rtCheckAllocation();
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return 22; // EINVAL
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer != nullptr ? 0 : 12; // ENOMEM
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    typedef int (*Lock)(pthread_mutex_t*);
+    static std::atomic<Lock> real{nullptr}; // not a function local static with a guard, the guard could lock a mutex
+    Lock lock = real.load(std::memory_order_acquire);
+    if (lock == nullptr) {
+        lock = reinterpret_cast<Lock>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        real.store(lock, std::memory_order_release);
+    }
+    if (rtCheckDepth > 0) {
+        rtCheckThreadCounts.locks++;
+        rtCheckViolation("mutex lock");
+    }
+    return lock(mutex);
+}
+}
+#else
+// operator new calls malloc with glibc, so it is only replaced where malloc can't be
+void* operator new(size_t size) {
+    rtCheckAllocation();
+    if (void* pointer = std::malloc(size != 0 ? size : 1)) return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    rtCheckAllocation();
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void* pointer) noexcept {
+    rtCheckFree(pointer);
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+#endif
+
+// everything the thread does until the scope ends has to be real time safe
+struct RealtimeScope {
+    const char* previousName;
+    RtCheckCounts start;
+
+    explicit RealtimeScope(const char* name) : previousName(rtCheckScopeName), start(rtCheckThreadCounts) {
+        rtCheckScopeName = name;
+        rtCheckDepth++;
+    }
+
+    ~RealtimeScope() {
+        rtCheckDepth--;
+        rtCheckScopeName = previousName;
+    }
+
+    RealtimeScope(const RealtimeScope&) = delete;
+    RealtimeScope& operator=(const RealtimeScope&) = delete;
+
+    // what this thread did wrong since the scope started
+    [[nodiscard]] RtCheckCounts counts() const {
+        return {rtCheckThreadCounts.allocations - start.allocations, rtCheckThreadCounts.frees - start.frees, rtCheckThreadCounts.locks - start.locks};
+    }
+};
+
+#else
+
+struct RealtimeScope {
+    explicit RealtimeScope(const char*) {}
+
+    [[nodiscard]] RtCheckCounts counts() const {
+        return {};
+    }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "dsp.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// C++17 basic LightDaw silence maps
+// most stems are silent for long stretches (a bass that only plays in the chorus), mixing, limiting or drawing those stretches
+// sample by sample is wasted work. a SilenceMap remembers, for every SILENCE_BLOCK samples, whether the block is silent
+// (its peak is under the threshold), so the loops can step over silent blocks without reading them.
+// a silent block is treated as exact silence, whatever is under the threshold (about -100 dB) can be dropped
+
+#define SILENCE_BLOCK 512 // samples, a divisor of PAGED_BUFFER_PAGE (see pagedbuffer.h)
+#define SILENCE_THRESHOLD 1e-5f // peak, about -100 dB
+
+inline bool isSilent(const float* samples, size_t frames, float threshold = SILENCE_THRESHOLD) {
+    return dspPeak(samples, frames) < threshold;
+}
+
+struct SilenceMap {
+    std::vector<uint8_t> silent; // one per block, 1 when the block is silent
+    size_t length = 0; // in samples
+
+    SilenceMap() = default;
+
+    // every block starts out silent
+    explicit SilenceMap(size_t frames) {
+        resize(frames);
+    }
+
+    static SilenceMap analyze(const float* samples, size_t frames, float threshold = SILENCE_THRESHOLD) {
+        SilenceMap map(frames);
+        for (size_t block = 0; block < map.blocks(); block++) {
+            size_t start = block * SILENCE_BLOCK;
+            map.silent[block] = ::isSilent(samples + start, std::min<size_t>(SILENCE_BLOCK, frames - start), threshold);
+        }
+        return map;
+    }
+
+    void resize(size_t frames) {
+        silent.resize((frames + SILENCE_BLOCK - 1) / SILENCE_BLOCK, 1);
+        length = frames;
+    }
+
+    [[nodiscard]] size_t blocks() const {
+        return silent.size();
+    }
+
+    void mark(size_t block, bool isBlockSilent) {
+        silent[block] = isBlockSilent;
+    }
+
+    // true when every block overlapping [position, position + frames) is silent, anything past the end is silent
+    [[nodiscard]] bool isSilent(size_t position, size_t frames) const {
+        size_t first = position / SILENCE_BLOCK;
+        size_t last = std::min(blocks(), (position + frames + SILENCE_BLOCK - 1) / SILENCE_BLOCK);
+        for (size_t block = first; block < last; block++) {
+            if (!silent[block]) return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] size_t silentBlocks() const {
+        return static_cast<size_t>(std::count(silent.begin(), silent.end(), static_cast<uint8_t>(1)));
+    }
+
+    // calls f(first sample, frames) for every run of blocks that isn't silent in [position, position + frames)
+    template<typename F>
+    void forEachSound(size_t position, size_t frames, F&& f) const {
+        size_t end = std::min(position + frames, length);
+        size_t at = position;
+        while (at < end) {
+            size_t block = at / SILENCE_BLOCK;
+            if (silent[block]) {
+                at = (block + 1) * SILENCE_BLOCK;
+                continue;
+            }
+            size_t runEnd = (block + 1) * SILENCE_BLOCK;
+            while (runEnd < end && !silent[runEnd / SILENCE_BLOCK]) {
+                runEnd += SILENCE_BLOCK;
+            }
+            runEnd = std::min(runEnd, end);
+            f(at, runEnd - at);
+            at = runEnd;
+        }
+    }
+};
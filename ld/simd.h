@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// C++17 basic LightDaw runtime cpu feature detection
+// kernels are compiled for every instruction set we support (with target attributes, so the rest of the program
+// doesn't need any special compiler flags) and the best one the cpu can actually run is picked once at startup.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LD_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(LD_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define LD_TARGET_SSE2 __attribute__((target("sse2")))
+#define LD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define LD_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define LD_TARGET_SSE2
+#define LD_TARGET_AVX2
+#define LD_TARGET_AVX512
+#endif
+
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2, // also requires FMA
+    AVX512 // AVX-512F
+};
+
+inline const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Scalar: return "Scalar";
+        case SimdLevel::SSE2: return "SSE2";
+        case SimdLevel::AVX2: return "AVX2";
+        case SimdLevel::AVX512: return "AVX-512";
+    }
+    return "Unknown";
+}
+
+#ifdef LD_SIMD_X86
+inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = (uint32_t)r[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
+
+// the best level this cpu (and os, the wide registers have to be saved on context switches) supports
+inline SimdLevel detectSimdLevel() {
+#ifdef LD_SIMD_X86
+    uint32_t r[4];
+    cpuid(0, 0, r);
+    uint32_t maxLeaf = r[0];
+    cpuid(1, 0, r);
+    bool sse2 = (r[3] >> 26) & 1;
+    bool fma = (r[2] >> 12) & 1;
+    bool osxsave = (r[2] >> 27) & 1;
+    bool avx = (r[2] >> 28) & 1;
+    if (!sse2) return SimdLevel::Scalar;
+    if (!osxsave || !avx || maxLeaf < 7) return SimdLevel::SSE2;
+    uint64_t xcr0 = xgetbv0();
+    if ((xcr0 & 0x6) != 0x6) return SimdLevel::SSE2; // xmm and ymm state
+    cpuid(7, 0, r);
+    bool avx2 = (r[1] >> 5) & 1;
+    bool avx512f = (r[1] >> 16) & 1;
+    if (avx512f && fma && (xcr0 & 0xe6) == 0xe6) return SimdLevel::AVX512; // plus opmask and zmm state
+    if (avx2 && fma) return SimdLevel::AVX2;
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+struct SimdState {
+    SimdLevel detected = detectSimdLevel();
+    std::atomic<SimdLevel> active{detected}; // read by every dispatch, on any thread
+};
+
+inline SimdState& simdState() {
+    static SimdState state;
+    return state;
+}
+
+// the level kernels are dispatched to right now
+inline SimdLevel simdLevel() {
+    return simdState().active.load(std::memory_order_relaxed);
+}
+
+// force a lower level (e.g. to compare against the scalar fallback), it can never go above what was detected
+inline void setSimdLevel(SimdLevel level) {
+    SimdState& state = simdState();
+    state.active.store(level > state.detected ? state.detected : level, std::memory_order_relaxed);
+}
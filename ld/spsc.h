@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// C++17 basic LightDaw single producer, single consumer queue
+// a fixed size ring that one thread pushes into and one other thread pops from, without locks or allocation,
+// push and pop are wait-free, which is what the audio thread needs: it can never be made to wait for the ui (or the other way around)
+
+#define LD_CACHE_LINE 64
+
+template<typename T, size_t Capacity>
+struct SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+    // head and tail only ever grow, the slot is the index modulo Capacity. they are on their own cache lines
+    // so the two threads don't keep stealing the line from each other
+    alignas(LD_CACHE_LINE) std::atomic<size_t> head{0}; // next slot to pop, only written by the consumer
+    alignas(LD_CACHE_LINE) std::atomic<size_t> tail{0}; // next slot to push, only written by the producer
+    alignas(LD_CACHE_LINE) T slots[Capacity];
+
+    // producer only, false when the queue is full
+    bool push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+        slots[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only, false when the queue is empty
+    bool pop(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = slots[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer only, the slot the next push goes into so big elements can be filled in place, nullptr when full.
+    // nothing is pushed until commit()
+    T* reserve() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return nullptr;
+        return &slots[t & (Capacity - 1)];
+    }
+
+    void commit() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer only, the oldest element without removing it, nullptr when empty. it stays valid until drop()
+    T* peek() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return nullptr;
+        return &slots[h & (Capacity - 1)];
+    }
+
+    void drop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // a snapshot, it can be out of date by the time it is used
+    [[nodiscard]] size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size() == 0;
+    }
+};
@@ -3,6 +3,8 @@
 #include "filetools.h"
 
 #include "audio.h"
+#include "voice.h"
+#include "oscillator.h"
 #include <cmath>
 
 #define GLOBAL_VOLUME 0.5f // this lets us mix without clipping
@@ -15,12 +17,44 @@ struct Synth { // abstract class
     float amplitude = 0.5;
     float volume = 1.0;
     bool open = false;
+    bool edited = false; // drawGui changed a parameter, whoever re-renders the synth clears it
+    OscMode oscMode = OscMode::Wavetable;
 
-    virtual AudioBuffer generateSamples(size_t sampleCount) = 0;
+    Synth() {
+        wavetables(); // build the shared tables now, not in the middle of the first audio block
+    }
+
+    // add `frames` samples to out (it is never cleared, so multiple notes can be mixed into the same block)
+    // offset is how many samples into the note the block starts, this lets a note be rendered one block at a time
+    virtual void process(float* out, size_t frames, size_t offset = 0) {
+        // a note on its own is just a voice that is `offset` samples old
+        Voice voice;
+        voice.active = true;
+        voice.age = offset;
+        voice.phase = Oscillator::phaseAt(frequency / sampleRate, offset);
+        processVoice(voice, out, frames);
+    }
+
+    virtual AudioBuffer generateSamples(size_t sampleCount) {
+        AudioBuffer buffer(sampleCount);
+        process(buffer.data(), sampleCount);
+        return buffer;
+    }
     virtual AudioBuffer generateSeconds(double seconds) {
         return generateSamples(static_cast<size_t>(seconds * sampleRate));
     }
 
+    // add a block of one voice to out and advance it, frequency and amplitude are already set for the voice
+    virtual void processVoice(Voice& voice, float* out, size_t frames) = 0;
+
+    // a copy with the same parameters, so a render on another thread never shares state with this one
+    [[nodiscard]] virtual Synth* clone() const = 0;
+
+    // how long a voice keeps sounding after note off
+    [[nodiscard]] virtual size_t releaseSamples() const {
+        return 0;
+    }
+
     virtual void update(double time, double bpm) {} // time in seconds
 
     virtual ~Synth() = default;
@@ -30,106 +64,144 @@ struct Synth { // abstract class
     // this function lets the gui of what parameters the synth has, and how to change them
     // this function is not required to be implemented, but if it isn't the synth has no GUI/parameters
 
+    // headless builds (LD_HEADLESS, see ldrender.cpp) have no ImGui, there the synths have no gui at all
     virtual void drawGui() {
+#ifndef LD_HEADLESS
         if (ImGui::Begin("Base Synth", &open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoDocking)) {
             ImGui::Text("Base Synth");
             ImGui::End();
         }
+#endif
     }
 
+    // the simple synths only have the oscillator mode, older files have no parameters at all and use the direct oscillator
     virtual ByteBuffer serializeParams() {
-        return {};
+        return {static_cast<uint8_t>(oscMode)};
     }
 
     virtual DeserializeResult deserializeParams(const ByteBuffer& data) {
+        if (data.empty()) {
+            oscMode = OscMode::Direct;
+            return Success;
+        }
+        if (data.size() != 1 || data[0] > static_cast<uint8_t>(OscMode::Wavetable)) return Failure;
+        oscMode = static_cast<OscMode>(data[0]);
         return Success;
     }
+
+protected:
+#ifndef LD_HEADLESS
+    void drawOscModeGui() {
+        bool bandLimited = oscMode == OscMode::Wavetable;
+        if (ImGui::Checkbox("Band-limited", &bandLimited)) {
+            oscMode = bandLimited ? OscMode::Wavetable : OscMode::Direct;
+            edited = true;
+        }
+    }
+#endif
+
+    // a plain oscillator without an envelope, there is no release tail so the voice just ends on note off
+    void oscillate(Waveform wave, Voice& voice, float* out, size_t frames) {
+        if (voice.released) {
+            voice.active = false;
+            return;
+        }
+        Oscillator osc(voice.phase, frequency / sampleRate, oscMode);
+        osc.process(wave, out, frames, amplitude);
+        voice.phase = osc.phase;
+        voice.age += frames;
+        voice.level = 1.0f;
+    }
 };
 
 struct SineSynth : public Synth {
 
-    AudioBuffer generateSamples(size_t sampleCount) override {
-        AudioBuffer buffer(sampleCount);
-        for (size_t i = 0; i < sampleCount; i++) {
-            float t = static_cast<float>(i) / sampleRate;
-            float value = amplitude * std::sin(2.0f * (float)M_PI * frequency * t);
-            buffer[i] = value;
-        }
-        return buffer;
+    void processVoice(Voice& voice, float* out, size_t frames) override {
+        oscillate(Waveform::Sine, voice, out, frames);
+    }
+
+    [[nodiscard]] Synth* clone() const override {
+        return new SineSynth(*this);
     }
 
     inline static const uint64_t id = 1;
 
+#ifndef LD_HEADLESS
     void drawGui() override {
         if (ImGui::Begin("Sine Synth", &open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoDocking)) {
             ImGui::Text("Sine Synth");
+            drawOscModeGui();
             ImGui::End();
         }
     }
+#endif
 };
 
 struct TriangleSynth : public Synth {
 
-    AudioBuffer generateSamples(size_t sampleCount) override {
-        AudioBuffer buffer(sampleCount);
-        for (size_t i = 0; i < sampleCount; i++) {
-            float t = static_cast<float>(i) / sampleRate;
-            float value = amplitude * 2.0f * std::abs(2.0f * (frequency * t - std::floor(frequency * t + 0.5f))) - 1.0f;
-            buffer[i] = value;
-        }
-        return buffer;
+    void processVoice(Voice& voice, float* out, size_t frames) override {
+        oscillate(Waveform::Triangle, voice, out, frames);
+    }
+
+    [[nodiscard]] Synth* clone() const override {
+        return new TriangleSynth(*this);
     }
 
     inline static const uint64_t id = 2;
 
+#ifndef LD_HEADLESS
     void drawGui() override {
         if (ImGui::Begin("Triangle Synth", &open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoDocking)) {
             ImGui::Text("Triangle Synth");
+            drawOscModeGui();
             ImGui::End();
         }
     }
+#endif
 };
 
 struct SquareSynth : public Synth {
-    AudioBuffer generateSamples(size_t sampleCount) override {
-        AudioBuffer buffer(sampleCount);
-        for (size_t i = 0; i < sampleCount; i++) {
-            float t = static_cast<float>(i) / sampleRate;
-            float value = amplitude * (std::sin(2.0f * (float)M_PI * frequency * t) > 0.0f ? 1.0f : -1.0f);
-            buffer[i] = value;
-        }
-        return buffer;
+    void processVoice(Voice& voice, float* out, size_t frames) override {
+        oscillate(Waveform::Square, voice, out, frames);
+    }
+
+    [[nodiscard]] Synth* clone() const override {
+        return new SquareSynth(*this);
     }
 
     inline static const uint64_t id = 3;
 
+#ifndef LD_HEADLESS
     void drawGui() override {
         if (ImGui::Begin("Square Synth", &open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoDocking)) {
             ImGui::Text("Square Synth");
+            drawOscModeGui();
             ImGui::End();
         }
     }
+#endif
 };
 
 struct SawSynth : public Synth {
-    AudioBuffer generateSamples(size_t sampleCount) override {
-        AudioBuffer buffer(sampleCount);
-        for (size_t i = 0; i < sampleCount; i++) {
-            float t = static_cast<float>(i) / sampleRate;
-            float value = amplitude * 2.0f * (frequency * t - std::floor(frequency * t + 0.5f));
-            buffer[i] = value;
-        }
-        return buffer;
+    void processVoice(Voice& voice, float* out, size_t frames) override {
+        oscillate(Waveform::Saw, voice, out, frames);
+    }
+
+    [[nodiscard]] Synth* clone() const override {
+        return new SawSynth(*this);
     }
 
     inline static const uint64_t id = 4;
 
+#ifndef LD_HEADLESS
     void drawGui() override {
         if (ImGui::Begin("Saw Synth", &open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoDocking)) {
             ImGui::Text("Saw Synth");
+            drawOscModeGui();
             ImGui::End();
         }
     }
+#endif
 };
 
 struct EnvelopeSynth : public Synth {
@@ -140,76 +212,114 @@ struct EnvelopeSynth : public Synth {
     float attackVol = 1.0f;
     float decayVol = 0.5f;
     float releaseVol = 0.0f;
-    float currentVol = 0.0f;
     // what to use (sine, triangle, square, saw)
-    enum class WaveType {
-        Sine,
-        Triangle,
-        Square,
-        Saw
-    } waveType = WaveType::Sine;
-
-    AudioBuffer generateSamples(size_t sampleCount) override {
-        AudioBuffer buffer(sampleCount);
-        float time = 0.0f;
-        for (size_t i = 0; i < sampleCount; i++) {
-            float t = static_cast<float>(i) / sampleRate;
-            if (time < attack) {
-                currentVol = time / attack * (attackVol - 0.0f) + 0.0f;
-            } else if (time < attack + decay) {
-                currentVol = (time - attack) / decay * (decayVol - attackVol) + attackVol;
-            } else if (time < attack + decay + sustain) {
-                currentVol = sustain;
-            } else if (time < attack + decay + sustain + release) {
-                currentVol = (time - attack - decay - sustain) / release * (releaseVol - sustain) + sustain;
+    using WaveType = Waveform;
+    WaveType waveType = WaveType::Sine;
+
+    // the envelope is made of linear segments, this finds the one the voice is in `age` samples after note on
+    // gain is the level at `age`, step is how much it changes every sample, returns how many samples are left in the segment
+    size_t envelopeSegment(size_t age, float& gain, float& step) const {
+        auto t = static_cast<float>(age);
+        float a = attack * sampleRate;
+        float d = decay * sampleRate;
+        float s = sustain * sampleRate;
+        float r = release * sampleRate;
+        if (t < a) {
+            step = attackVol / a;
+            gain = t * step;
+            return static_cast<size_t>(std::ceil(a)) - age;
+        } else if (t < a + d) {
+            step = (decayVol - attackVol) / d;
+            gain = attackVol + (t - a) * step;
+            return static_cast<size_t>(std::ceil(a + d)) - age;
+        } else if (t < a + d + s) {
+            step = 0.0f;
+            gain = sustain;
+            return static_cast<size_t>(std::ceil(a + d + s)) - age;
+        } else if (t < a + d + s + r) {
+            step = (releaseVol - sustain) / r;
+            gain = sustain + (t - a - d - s) * step;
+            return static_cast<size_t>(std::ceil(a + d + s + r)) - age;
+        }
+        gain = 0.0f;
+        step = 0.0f;
+        return SIZE_MAX;
+    }
+
+    // same as envelopeSegment, but for the release tail after note off
+    size_t releaseSegment(const Voice& voice, float& gain, float& step) const {
+        float r = release * sampleRate;
+        auto t = static_cast<float>(voice.releaseAge);
+        if (t >= r) {
+            return 0;
+        }
+        step = (releaseVol - voice.releaseLevel) / r;
+        gain = voice.releaseLevel + t * step;
+        return static_cast<size_t>(std::ceil(r)) - voice.releaseAge;
+    }
+
+    void processVoice(Voice& voice, float* out, size_t frames) override {
+        Oscillator osc(voice.phase, frequency / sampleRate, oscMode);
+        float vol = amplitude * GLOBAL_VOLUME;
+        size_t done = 0;
+        while (done < frames) {
+            float gain = 0.0f;
+            float step = 0.0f;
+            size_t left = voice.released ? releaseSegment(voice, gain, step) : envelopeSegment(voice.age, gain, step);
+            if (left == 0) {
+                voice.active = false;
+                break;
+            }
+            size_t n = std::min(left, frames - done);
+            if (gain == 0.0f && step == 0.0f) {
+                osc.skip(n);
             } else {
-                currentVol = 0.0f;
+                osc.processRamp(waveType, out + done, n, vol * gain, vol * step);
             }
-            float value = 0.0f;
-            float vol = amplitude * currentVol * GLOBAL_VOLUME;
-            switch (waveType) {
-                case WaveType::Sine:
-                    value = vol * std::sin(2.0f * (float)M_PI * frequency * t);
-                    break;
-                case WaveType::Triangle:
-                    value = vol * 2.0f * std::abs(2.0f * (frequency * t - std::floor(frequency * t + 0.5f))) - 1.0f;
-                    break;
-                case WaveType::Square:
-                    value = vol * (std::sin(2.0f * (float)M_PI * frequency * t) > 0.0f ? 1.0f : -1.0f);
-                    break;
-                case WaveType::Saw:
-                    value = vol * 2.0f * (frequency * t - std::floor(frequency * t + 0.5f));
-                    break;
+            voice.level = gain + step * static_cast<float>(n);
+            voice.age += n;
+            if (voice.released) {
+                voice.releaseAge += n;
             }
-            buffer[i] = value;
-            time += 1.0f / sampleRate;
+            done += n;
         }
-        return buffer;
+        voice.phase = osc.phase;
+    }
+
+    [[nodiscard]] size_t releaseSamples() const override {
+        return static_cast<size_t>(std::ceil(release * sampleRate));
+    }
+
+    [[nodiscard]] Synth* clone() const override {
+        return new EnvelopeSynth(*this);
     }
 
     inline static const uint64_t id = 5;
 
+#ifndef LD_HEADLESS
     void drawGui() override {
         if (ImGui::Begin("Envelope Synth", &open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoDocking)) {
             ImGui::Text("Envelope Synth");
             // basic combo
             if (ImGui::BeginCombo("Wave Type", waveType == WaveType::Sine ? "Sine" : waveType == WaveType::Triangle ? "Triangle" : waveType == WaveType::Square ? "Square" : "Saw")) {
-                if (ImGui::Selectable("Sine", waveType == WaveType::Sine)) waveType = WaveType::Sine;
-                if (ImGui::Selectable("Triangle", waveType == WaveType::Triangle)) waveType = WaveType::Triangle;
-                if (ImGui::Selectable("Square", waveType == WaveType::Square)) waveType = WaveType::Square;
-                if (ImGui::Selectable("Saw", waveType == WaveType::Saw)) waveType = WaveType::Saw;
+                if (ImGui::Selectable("Sine", waveType == WaveType::Sine)) { waveType = WaveType::Sine; edited = true; }
+                if (ImGui::Selectable("Triangle", waveType == WaveType::Triangle)) { waveType = WaveType::Triangle; edited = true; }
+                if (ImGui::Selectable("Square", waveType == WaveType::Square)) { waveType = WaveType::Square; edited = true; }
+                if (ImGui::Selectable("Saw", waveType == WaveType::Saw)) { waveType = WaveType::Saw; edited = true; }
                 ImGui::EndCombo();
             }
-            ImGui::SliderFloat("Attack", &attack, 0.0f, 1.0f);
-            ImGui::SliderFloat("Decay", &decay, 0.0f, 1.0f);
-            ImGui::SliderFloat("Sustain", &sustain, 0.0f, 1.0f);
-            ImGui::SliderFloat("Release", &release, 0.0f, 1.0f);
-            ImGui::SliderFloat("Attack Volume", &attackVol, 0.0f, 1.0f);
-            ImGui::SliderFloat("Decay Volume", &decayVol, 0.0f, 1.0f);
-            ImGui::SliderFloat("Release Volume", &releaseVol, 0.0f, 1.0f);
+            drawOscModeGui();
+            edited |= ImGui::SliderFloat("Attack", &attack, 0.0f, 1.0f);
+            edited |= ImGui::SliderFloat("Decay", &decay, 0.0f, 1.0f);
+            edited |= ImGui::SliderFloat("Sustain", &sustain, 0.0f, 1.0f);
+            edited |= ImGui::SliderFloat("Release", &release, 0.0f, 1.0f);
+            edited |= ImGui::SliderFloat("Attack Volume", &attackVol, 0.0f, 1.0f);
+            edited |= ImGui::SliderFloat("Decay Volume", &decayVol, 0.0f, 1.0f);
+            edited |= ImGui::SliderFloat("Release Volume", &releaseVol, 0.0f, 1.0f);
             ImGui::End();
         }
     }
+#endif
 
     ByteBuffer serializeParams() override {
         ByteBuffer buffer;
@@ -223,12 +333,13 @@ struct EnvelopeSynth : public Synth {
         w.writeFloat32(releaseVol);
         auto waveTypeInt = static_cast<uint8_t>(waveType);
         w.write8(waveTypeInt);
+        w.write8(static_cast<uint8_t>(oscMode));
 
         return buffer;
     }
 
     DeserializeResult deserializeParams(const ByteBuffer& data) override {
-        if (data.size() != 29) return Failure;
+        if (data.size() != 29 && data.size() != 30) return Failure; // 29 bytes is the format from before the oscillator mode
         Reader r(data);
         attack = r.readFloat32();
         decay = r.readFloat32();
@@ -239,6 +350,12 @@ struct EnvelopeSynth : public Synth {
         releaseVol = r.readFloat32();
         auto waveTypeInt = r.read8();
         waveType = static_cast<WaveType>(waveTypeInt);
+        oscMode = OscMode::Direct;
+        if (data.size() == 30) {
+            auto oscModeInt = r.read8();
+            if (oscModeInt > static_cast<uint8_t>(OscMode::Wavetable)) return Failure;
+            oscMode = static_cast<OscMode>(oscModeInt);
+        }
         return Success;
     }
 };
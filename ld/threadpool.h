@@ -0,0 +1,151 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// C++17 basic LightDaw worker threads
+// rendering a pattern is independent from rendering every other pattern, so they are handed to a pool of threads
+// that is started once (one per core) and kept around, instead of starting threads every time play is pressed.
+// never submit from or wait on the audio thread, the queue is protected by a mutex
+
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake; // a task was added, or the pool is stopping
+    std::condition_variable idle; // a task finished
+    size_t running = 0;
+    bool stopping = false;
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+        if (threads == 0) threads = 1; // hardware_concurrency can return 0 when it doesn't know
+        for (size_t i = 0; i < threads; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            tasks.clear(); // whatever didn't start yet is dropped, running tasks are finished
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] size_t size() const {
+        return workers.size();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // block until every submitted task is done
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return tasks.empty() && running == 0; });
+    }
+
+private:
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping) return;
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            running++;
+            lock.unlock();
+            task();
+            lock.lock();
+            running--;
+            if (tasks.empty() && running == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+};
+
+// a set of tasks on a pool that can be waited for on their own, ThreadPool::wait waits for everybody's tasks.
+// several renders can share one pool this way (see ld/batch.h). never wait on a group from a task of the same pool,
+// when every worker does that nobody is left to run the tasks.
+// an exception thrown by a task doesn't reach the pool's thread, the first one is thrown again by wait
+struct TaskGroup {
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+    std::exception_ptr error;
+
+    explicit TaskGroup(ThreadPool& pool) : pool(pool) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        finish(); // the tasks can still reference the group
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending++;
+        }
+        pool.submit([this, task = std::move(task)] {
+            std::exception_ptr thrown;
+            try {
+                task();
+            } catch (...) {
+                thrown = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (thrown && !error) {
+                error = thrown;
+            }
+            if (--pending == 0) {
+                done.notify_all();
+            }
+        });
+    }
+
+    // blocks until every task is done, then throws the first exception a task threw (once)
+    void wait() {
+        finish();
+        std::exception_ptr thrown;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(thrown, error);
+        }
+        if (thrown) {
+            std::rethrow_exception(thrown);
+        }
+    }
+
+private:
+    void finish() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+    }
+};
+
+// the pool everything renders on, created the first time it is used
+inline ThreadPool& renderPool() {
+    static ThreadPool pool;
+    return pool;
+}
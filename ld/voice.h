@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// C++17 basic LightDaw voice allocator
+// a voice is one sounding note, all the state a note needs while it is playing lives here (not in the synth),
+// so one synth can play any number of notes at once, and a block can be rendered for every voice in turn.
+// the pool is allocated once, when it is full a voice is stolen instead of allocating a new one,
+// this keeps cpu and memory bounded no matter how dense the midi is.
+
+#define DEFAULT_VOICE_COUNT 64
+
+struct Voice {
+    bool active = false;
+    bool released = false; // note off was received, the voice is playing its release tail
+    uint64_t note = 0; // who started the voice, used to find it again on note off
+    uint64_t order = 0; // when the voice was started, higher is newer
+    double freq = 0.0;
+    double vol = 0.0;
+    double phase = 0.0; // oscillator phase in cycles, carried from block to block
+    size_t age = 0; // samples since note on, this drives the envelope
+    size_t releaseAge = 0; // samples since note off
+    float level = 0.0f; // current envelope level
+    float releaseLevel = 0.0f; // envelope level at note off, the release tail starts here
+};
+
+enum class StealPolicy {
+    Oldest, // steal the voice that was started first
+    Quietest, // steal the voice with the lowest envelope level
+    None // drop the new note
+};
+
+struct VoicePool {
+    std::vector<Voice> voices;
+    StealPolicy policy = StealPolicy::Oldest;
+    uint64_t counter = 0;
+    size_t stolen = 0; // how many voices had to be stolen, handy to tune the pool size
+
+    explicit VoicePool(size_t size = DEFAULT_VOICE_COUNT, StealPolicy policy = StealPolicy::Oldest) : voices(size), policy(policy) {}
+
+    Voice* noteOn(uint64_t note, double freq, double vol) {
+        Voice* voice = findFree();
+        if (voice == nullptr) {
+            voice = findSteal();
+            if (voice == nullptr) return nullptr;
+            stolen++;
+        }
+        *voice = Voice();
+        voice->active = true;
+        voice->note = note;
+        voice->order = counter++;
+        voice->freq = freq;
+        voice->vol = vol;
+        return voice;
+    }
+
+    void noteOff(uint64_t note) {
+        for (Voice& voice : voices) {
+            if (voice.active && !voice.released && voice.note == note) {
+                voice.released = true;
+                voice.releaseLevel = voice.level;
+                voice.releaseAge = 0;
+            }
+        }
+    }
+
+    void reset() {
+        for (Voice& voice : voices) {
+            voice.active = false;
+        }
+    }
+
+    [[nodiscard]] size_t activeCount() const {
+        size_t count = 0;
+        for (const Voice& voice : voices) {
+            if (voice.active) count++;
+        }
+        return count;
+    }
+
+private:
+    Voice* findFree() {
+        for (Voice& voice : voices) {
+            if (!voice.active) return &voice;
+        }
+        return nullptr;
+    }
+
+    Voice* findSteal() {
+        Voice* best = nullptr;
+        for (Voice& voice : voices) {
+            if (best == nullptr) {
+                best = &voice;
+                continue;
+            }
+            // a voice that is already releasing is always a better victim than a held one
+            if (voice.released != best->released) {
+                if (voice.released) best = &voice;
+                continue;
+            }
+            if (policy == StealPolicy::Oldest && voice.order < best->order) {
+                best = &voice;
+            } else if (policy == StealPolicy::Quietest && voice.level < best->level) {
+                best = &voice;
+            }
+        }
+        if (policy == StealPolicy::None) return nullptr;
+        return best;
+    }
+};
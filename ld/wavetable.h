@@ -0,0 +1,100 @@
+#pragma once
+
+#include "osckernels.h"
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// C++17 basic LightDaw band-limited wavetables
+// the naive square/saw/triangle formulas contain harmonics all the way up, everything above nyquist folds back down
+// as aliasing. instead, every wave is built once from its fourier series, with one table per octave (a mip map)
+// that only holds the harmonics that still fit below nyquist for notes in that octave.
+// the tables are generated the first time they are used and then only ever read, so every synth shares the same ones
+
+#define WAVETABLE_SIZE 4096 // samples per cycle, a power of two
+#define WAVETABLE_LEVELS 11 // octaves
+#define WAVETABLE_TOP_HARMONIC 1024 // harmonics in the lowest table, every level above has half as many
+
+struct WavetableSet {
+    // tables[wave][level], each has one extra sample at the end (a copy of the first) so lookups never have to wrap
+    std::vector<float> tables[4][WAVETABLE_LEVELS];
+
+    WavetableSet() {
+        std::vector<double> sine(WAVETABLE_SIZE);
+        for (size_t i = 0; i < WAVETABLE_SIZE; i++) {
+            sine[i] = std::sin(2.0 * M_PI * static_cast<double>(i) / WAVETABLE_SIZE);
+        }
+        build(Waveform::Sine, sine, [](size_t h, double& sinGain, double& cosGain) {
+            sinGain = h == 1 ? 1.0 : 0.0;
+            cosGain = 0.0;
+        });
+        build(Waveform::Saw, sine, [](size_t h, double& sinGain, double& cosGain) {
+            sinGain = (h % 2 == 1 ? 2.0 : -2.0) / (M_PI * static_cast<double>(h));
+            cosGain = 0.0;
+        });
+        build(Waveform::Square, sine, [](size_t h, double& sinGain, double& cosGain) {
+            sinGain = h % 2 == 1 ? 4.0 / (M_PI * static_cast<double>(h)) : 0.0;
+            cosGain = 0.0;
+        });
+        build(Waveform::Triangle, sine, [](size_t h, double& sinGain, double& cosGain) {
+            sinGain = 0.0;
+            cosGain = h % 2 == 1 ? -8.0 / (M_PI * M_PI * static_cast<double>(h * h)) : 0.0;
+        });
+    }
+
+    // the table for a wave played at `inc` cycles per sample, the one with the most harmonics that all stay below nyquist
+    [[nodiscard]] const float* table(Waveform wave, double inc) const {
+        size_t level = 0;
+        while (level + 1 < WAVETABLE_LEVELS && static_cast<double>(WAVETABLE_TOP_HARMONIC >> level) * inc > 0.5) {
+            level++;
+        }
+        return tables[static_cast<size_t>(wave)][level].data();
+    }
+
+private:
+    // the levels are built from the top (fewest harmonics) down, so every level only adds the harmonics it has on top of the previous one
+    template<typename F>
+    void build(Waveform wave, const std::vector<double>& sine, F coefficients) {
+        std::vector<double> sum(WAVETABLE_SIZE, 0.0);
+        size_t harmonic = 1;
+        for (size_t level = WAVETABLE_LEVELS; level-- > 0;) {
+            size_t top = WAVETABLE_TOP_HARMONIC >> level;
+            for (; harmonic <= top; harmonic++) {
+                double sinGain = 0.0;
+                double cosGain = 0.0;
+                coefficients(harmonic, sinGain, cosGain);
+                if (sinGain == 0.0 && cosGain == 0.0) continue;
+                for (size_t i = 0; i < WAVETABLE_SIZE; i++) {
+                    size_t index = harmonic * i;
+                    sum[i] += sinGain * sine[index & (WAVETABLE_SIZE - 1)] + cosGain * sine[(index + WAVETABLE_SIZE / 4) & (WAVETABLE_SIZE - 1)];
+                }
+            }
+            std::vector<float>& table = tables[static_cast<size_t>(wave)][level];
+            table.resize(WAVETABLE_SIZE + 1);
+            for (size_t i = 0; i < WAVETABLE_SIZE; i++) {
+                table[i] = static_cast<float>(sum[i]);
+            }
+            table[WAVETABLE_SIZE] = table[0];
+        }
+    }
+};
+
+// the shared tables, the first call builds them (a few milliseconds), so make sure that happens before audio starts
+inline const WavetableSet& wavetables() {
+    static const WavetableSet set;
+    return set;
+}
+
+// same contract as the kernels in osckernels.h, but reads the wave from a table with linear interpolation
+inline void oscRampTable(const float* table, float* out, size_t frames, float phase, float inc, float gain, float step) {
+    for (size_t i = 0; i < frames; i++) {
+        float p = phase + static_cast<float>(i) * inc;
+        p -= std::floor(p);
+        float x = p * WAVETABLE_SIZE;
+        auto index = static_cast<size_t>(x);
+        float frac = x - static_cast<float>(index);
+        index &= WAVETABLE_SIZE - 1; // p can round up to exactly 1
+        float value = table[index] + frac * (table[index + 1] - table[index]);
+        out[i] += (gain + step * static_cast<float>(i)) * value;
+    }
+}
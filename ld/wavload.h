@@ -252,7 +252,7 @@ struct WavFile {
         return buffer;
     }
 
-    void saveToFile(const std::string& filename) {
-        writeFile(filename, toBytes());
+    bool saveToFile(const std::string& filename) {
+        return writeFile(filename, toBytes());
     }
 };
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ld/batch.h"
+
+// C++17 basic LightDaw command line renderer
+// renders a project (.ldpa) into a wav file, without a window or an audio device, so it runs on machines without a display.
+// built with LD_HEADLESS (see CMakeLists.txt), it only uses the engine, never glfw or ImGui
+//
+//     ldrender song.ldpa -o song.wav --format s16 --start 30 --end 60 --threads 8 --stats
+//
+// with --batch it renders every job of a manifest instead (see ld/batch.h), one job per line with the same render options
+// as the command line, # starts a comment and paths with spaces go in double quotes. relative paths are relative to the manifest
+//
+//     # song.ldpa three times, the stems are only rendered once
+//     song.ldpa -o out/song.wav
+//     song.ldpa -o out/song.wav --stems
+//     song.ldpa -o out/chorus.wav --start 30 --end 60
+//     "old songs/demo.ldpa" -o out/demo.wav --format u8
+//
+//     ldrender --batch jobs.txt --report report.json --memory 4096
+
+void printUsage() {
+    std::cerr << "Usage: ldrender <project.ldpa> -o <output.wav> [options]\n"
+              << "       ldrender --batch <manifest> [--report <report.json>] [options]\n"
+              << "Render options (also on every line of a manifest):\n"
+              << "  -o, --output <file>      wav file to write\n"
+              << "  -f, --format <format>    sample format: u8, s16 (default) or s32\n"
+              << "  -s, --start <seconds>    start of the time range (default 0)\n"
+              << "  -e, --end <seconds>      end of the time range (default the end of the song)\n"
+              << "  -p, --pattern <index>    only render one pattern (default every pattern)\n"
+              << "  --stems                  write a wav per pair instead of the mix (song.1-bass.wav, ...)\n"
+              << "  --ceiling <dB>           limiter ceiling (default " << LIMITER_CEILING_DB << ")\n"
+              << "  --release <ms>           limiter release (default " << LIMITER_RELEASE_MS << ")\n"
+              << "Options:\n"
+              << "  -j, --threads <count>    render threads (default one per core)\n"
+              << "  --batch <manifest>       render every job of the manifest\n"
+              << "  --jobs <count>           jobs rendered at the same time (default one per core)\n"
+              << "  --memory <MB>            memory for every running job and the stem cache together (default "
+              << BATCH_MEMORY_BUDGET / (1024 * 1024) << ")\n"
+              << "  --report <file>          write a json report with the timings and memory of every job\n"
+              << "  --stats                  print render statistics\n"
+              << "  -h, --help               show this help" << std::endl;
+}
+
+bool parseFormat(const std::string& name, AudioFormat& format) {
+    if (name == "u8") {
+        format = AudioFormat::UInt8;
+    } else if (name == "s16") {
+        format = AudioFormat::Int16;
+    } else if (name == "s32") {
+        format = AudioFormat::Int32;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#define LDRENDER_MAX_THREADS 1024 // for --threads and --jobs
+#define LDRENDER_MAX_SECONDS (24.0 * 3600.0) // for --start and --end, a day
+#define LDRENDER_MIN_CEILING_DB (-120.0)
+#define LDRENDER_MAX_CEILING_DB 24.0 // float wavs can go over 0 dBFS
+#define LDRENDER_MAX_RELEASE_MS 60000.0
+
+// a whole number in [min, max]. std::stoul would take -1 and wrap it around, so only digits are accepted.
+// throws std::invalid_argument
+size_t parseCount(const std::string& text, const std::string& option, size_t min, size_t max) {
+    if (text.empty() || !std::all_of(text.begin(), text.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+        throw std::invalid_argument(option + " needs a whole number, not " + text);
+    }
+    unsigned long long count = ULLONG_MAX;
+    try {
+        count = std::stoull(text);
+    } catch (const std::out_of_range&) {
+        // too large, caught by the check below
+    }
+    if (count < min || count > max) {
+        throw std::invalid_argument(option + " has to be between " + std::to_string(min) + " and " + std::to_string(max));
+    }
+    return static_cast<size_t>(count);
+}
+
+// a finite number in [min, max], all of the text. std::stod alone would take "nan", "inf" and "30s" (as 30).
+// throws std::invalid_argument
+double parseNumber(const std::string& text, const std::string& option, double min, double max) {
+    double number = 0.0;
+    size_t used = 0;
+    try {
+        number = std::stod(text, &used);
+    } catch (const std::logic_error&) { // invalid_argument and out_of_range
+        used = 0;
+    }
+    if (text.empty() || std::isspace(static_cast<unsigned char>(text[0])) || used != text.size() || !std::isfinite(number)) {
+        throw std::invalid_argument(option + " needs a number, not " + text);
+    }
+    if (number < min || number > max) {
+        std::ostringstream error;
+        error << option << " has to be between " << min << " and " << max;
+        throw std::invalid_argument(error.str());
+    }
+    return number;
+}
+
+// the render options of one job, from the command line or a line of a manifest. throws std::invalid_argument
+RenderJob parseJob(const std::vector<std::string>& args) {
+    RenderJob job;
+    double start = 0.0;
+    double end = -1.0; // the end of the song
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= args.size()) throw std::invalid_argument("missing value for " + arg);
+            return args[++i];
+        };
+        if (arg == "-o" || arg == "--output") {
+            job.output = value();
+        } else if (arg == "-f" || arg == "--format") {
+            std::string name = value();
+            if (!parseFormat(name, job.format)) throw std::invalid_argument("unknown sample format " + name);
+        } else if (arg == "-s" || arg == "--start") {
+            start = parseNumber(value(), arg, 0.0, LDRENDER_MAX_SECONDS);
+        } else if (arg == "-e" || arg == "--end") {
+            end = parseNumber(value(), arg, 0.0, LDRENDER_MAX_SECONDS);
+        } else if (arg == "-p" || arg == "--pattern") {
+            job.options.pattern = parseCount(value(), arg, 0, PROJECT_ALL_PATTERNS - 1);
+        } else if (arg == "--stems") {
+            job.stems = true;
+        } else if (arg == "--ceiling") {
+            job.options.ceilingDb = static_cast<float>(parseNumber(value(), arg, LDRENDER_MIN_CEILING_DB, LDRENDER_MAX_CEILING_DB));
+        } else if (arg == "--release") {
+            job.options.releaseMs = static_cast<float>(parseNumber(value(), arg, 0.0, LDRENDER_MAX_RELEASE_MS));
+        } else if (!arg.empty() && arg[0] != '-' && job.project.empty()) {
+            job.project = arg;
+        } else {
+            throw std::invalid_argument("unknown argument " + arg);
+        }
+    }
+    if (job.project.empty()) throw std::invalid_argument("no project");
+    if (job.output.empty()) throw std::invalid_argument("no output file");
+    if (start < 0 || (end >= 0 && end <= start)) throw std::invalid_argument("the time range is empty");
+    job.options.from = AudioOffset::fromSeconds(start).samples;
+    if (end >= 0) {
+        job.options.to = AudioOffset::fromSeconds(end).samples;
+    }
+    return job;
+}
+
+// splits a line of a manifest into arguments, like a shell would for the simple cases: spaces separate, "double quotes" group
+// and # starts a comment
+std::vector<std::string> splitManifestLine(const std::string& line) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool quoted = false;
+    bool inArg = false;
+    for (char c: line) {
+        if (quoted) {
+            if (c == '"') {
+                quoted = false;
+            } else {
+                arg += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+            inArg = true;
+        } else if (c == '#' && !inArg) {
+            break;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (inArg) args.push_back(arg);
+            arg.clear();
+            inArg = false;
+        } else {
+            arg += c;
+            inArg = true;
+        }
+    }
+    if (quoted) throw std::invalid_argument("missing closing quote");
+    if (inArg) args.push_back(arg);
+    return args;
+}
+
+bool isAbsolutePath(const std::string& path) {
+    return (!path.empty() && (path[0] == '/' || path[0] == '\\')) || (path.size() > 1 && path[1] == ':');
+}
+
+// false when the manifest couldn't be read or has a line that isn't a job (every bad line is printed)
+bool loadManifest(const std::string& manifest, std::vector<RenderJob>& jobs) {
+    std::ifstream file(manifest);
+    if (!file.is_open()) {
+        std::cerr << "Error: Failed to open manifest: " << manifest << std::endl;
+        return false;
+    }
+    size_t slash = manifest.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : manifest.substr(0, slash + 1);
+    bool ok = true;
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); number++) {
+        try {
+            std::vector<std::string> args = splitManifestLine(line);
+            if (args.empty()) continue;
+            RenderJob job = parseJob(args);
+            job.line = number;
+            if (!isAbsolutePath(job.project)) job.project = directory + job.project;
+            if (!isAbsolutePath(job.output)) job.output = directory + job.output;
+            jobs.push_back(job);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << manifest << ":" << number << ": " << e.what() << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void printStats(const RenderJobResult& result) {
+    const OfflineRenderStats& stats = result.stats;
+    BufferPoolStats pool = bufferPool().snapshot();
+    double seconds = static_cast<double>(stats.frames) / SAMPLE_RATE;
+    std::cout << "Rendered " << seconds << " s (" << stats.frames << " samples) of " << stats.pairs << " pairs, "
+              << stats.notes << " notes, to " << result.files.size() << " file(s)\n"
+              << "Time: " << stats.totalSeconds() * 1000.0 << " ms (stems " << stats.renderSeconds * 1000.0 << " ms on "
+              << stats.threads << " threads, mix " << stats.mixSeconds * 1000.0 << " ms, limiter " << stats.limitSeconds * 1000.0
+              << " ms), " << stats.speed() << "x real time\n"
+              << "Silence: " << stats.silentBlocks << " of " << stats.blocks << " stem blocks skipped\n"
+              << "Memory: " << stats.stemBytes / 1024 << " KB of stems, " << stats.mixPages << " mix pages, "
+              << result.peakBytes / 1024 << " KB peak (" << result.estimatedBytes / 1024 << " KB estimated), "
+              << pool.peak / 1024 << " KB peak in the buffer pool (" << pool.hitRate() * 100.0 << "% reused)\n"
+              << "Peak: " << 20.0f * std::log10(std::max(stats.peak, 1e-6f)) << " dBFS" << std::endl;
+}
+
+void printBatchStats(const BatchResult& batch) {
+    std::cout << "Batch: " << batch.jobs.size() << " jobs (" << batch.count(RenderJobResult::Status::Ok) << " ok, "
+              << batch.count(RenderJobResult::Status::Errors) << " with errors, " << batch.count(RenderJobResult::Status::Failed)
+              << " failed) in " << batch.seconds << " s, " << batch.concurrentJobs << " at a time on " << batch.threads << " threads\n"
+              << "Memory: " << batch.budgetPeak / (1024 * 1024) << " of " << batch.memoryBudget / (1024 * 1024) << " MB budget at most, "
+              << batch.budgetWaits << " jobs waited, " << batch.pool.peak / (1024 * 1024) << " MB peak in the buffer pool\n"
+              << "Stem cache: " << batch.cacheHits << " hits, " << batch.cacheMisses << " misses" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string manifest;
+    std::string report;
+    bool stats = false;
+    BatchSettings settings;
+    std::vector<std::string> jobArgs;
+    std::vector<RenderJob> jobs;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+                return argv[++i];
+            };
+            if (arg == "-h" || arg == "--help") {
+                printUsage();
+                return 0;
+            } else if (arg == "-j" || arg == "--threads") {
+                settings.threads = parseCount(value(), arg, 1, LDRENDER_MAX_THREADS);
+            } else if (arg == "--batch") {
+                manifest = value();
+            } else if (arg == "--jobs") {
+                settings.jobs = parseCount(value(), arg, 1, LDRENDER_MAX_THREADS);
+            } else if (arg == "--memory") {
+                settings.memoryBudget = parseCount(value(), arg, 1, SIZE_MAX / (1024 * 1024)) * 1024 * 1024;
+            } else if (arg == "--report") {
+                report = value();
+            } else if (arg == "--stats") {
+                stats = true;
+            } else {
+                // the render options are checked by parseJob, every one but --stems takes a value
+                jobArgs.push_back(arg);
+                if (i + 1 < argc && arg[0] == '-' && arg != "--stems") {
+                    jobArgs.emplace_back(argv[++i]);
+                }
+            }
+        }
+        if (manifest.empty()) {
+            jobs.push_back(parseJob(jobArgs));
+        } else if (!jobArgs.empty()) {
+            throw std::invalid_argument("render options go into the manifest with --batch: " + jobArgs[0]);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+    if (!manifest.empty()) {
+        if (!loadManifest(manifest, jobs)) return 1;
+        if (jobs.empty()) {
+            std::cerr << "Error: The manifest has no jobs: " << manifest << std::endl;
+            return 1;
+        }
+    }
+
+    BatchResult batch = runBatch(jobs, settings, [&](size_t index, size_t finished, const RenderJobResult& result) {
+        if (manifest.empty()) return;
+        std::cout << "[" << finished << "/" << jobs.size() << "] " << result.statusName() << " " << jobs[index].project
+                  << " -> " << jobs[index].output << " (" << result.totalSeconds << " s, " << result.stats.speed() << "x real time)" << std::endl;
+    });
+
+    if (!report.empty()) {
+        std::ofstream file(report);
+        if (file.is_open()) {
+            writeBatchReport(file, jobs, batch);
+        }
+        if (!file.is_open() || !file.good()) {
+            std::cerr << "Error: Failed to write report: " << report << std::endl;
+        }
+    }
+    if (stats) {
+        if (manifest.empty()) {
+            if (batch.jobs[0].status != RenderJobResult::Status::Failed) printStats(batch.jobs[0]);
+        } else {
+            printBatchStats(batch);
+        }
+    }
+    // whatever went wrong on the way (a missing midi, an instrument that isn't a synth) was already printed, it only changes the result
+    if (batch.count(RenderJobResult::Status::Failed) > 0) return 1;
+    return batch.count(RenderJobResult::Status::Errors) > 0 ? 2 : 0;
+}
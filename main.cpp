@@ -14,10 +14,14 @@
 #include "ld/synth.h"
 #include "ld/string.h"
 #include "ld/instrument.h"
+#include "ld/render.h"
+#include "ld/project.h"
 #include "tinyfiledialogs.h"
 #include <MidiFile.h>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <set>
 
 std::string midiNoteName(int note) {
     static const std::vector<std::string> notes = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
@@ -98,8 +102,10 @@ void AudioWaveform(ImVec2 size, AudioPlayer *player, double smoothDeltaTime) {
         // we will display a waveform of the samples
         size_t numSamples = SAMPLE_RATE * smoothDeltaTime;
 //            size_t numSamples = SAMPLE_RATE / 60;
+        if (numSamples > SCOPE_SIZE) {
+            numSamples = SCOPE_SIZE;
+        }
 
-        const AudioBuffer& samples = player->getBuffer();
         static const size_t limit = 100; // if we go over this, do every other sample (or every 3, or whatever is needed to stay under)
         // this is basically the quality of the waveform, lower is low quality, but better performance, higher makes it super smooth but slow
         int step = 1;
@@ -107,23 +113,20 @@ void AudioWaveform(ImVec2 size, AudioPlayer *player, double smoothDeltaTime) {
             step = numSamples / limit;
         }
         for (int i = 0; i < numSamples; i += step) {
-            float dat = 0.0f;
-            if (i + player->getPosition() < samples.size()) {
-                dat = samples[i+player->getPosition()];
-            }
-            audiodata.push_back(dat);
+            audiodata.push_back(player->getRecentSample(numSamples - 1 - i));
         }
     } else {
         audiodata = AudioBuffer(100);
     }
 
-    // normalize the audio data by finding the farthest from 0 (max(abs(max), abs(min))) and dividing by that
-    float max = 0.0f;
-    for (float f: audiodata) {
-        if (std::abs(f) > max) {
-            max = std::abs(f);
-        }
+    // nothing is playing most of the time, a silent stretch is just a flat line
+    if (isSilent(audiodata.data(), audiodata.size())) {
+        drawList->AddLine(ImVec2(position.x, position.y + size.y / 2), ImVec2(position.x + size.x, position.y + size.y / 2), waveColor);
+        return;
     }
+
+    // normalize the audio data by finding the farthest from 0 (max(abs(max), abs(min))) and dividing by that
+    float max = dspPeak(audiodata.data(), audiodata.size());
     if (max == 0.0f) {
         max = 1.0f;
     }
@@ -143,100 +146,153 @@ void AudioWaveform(ImVec2 size, AudioPlayer *player, double smoothDeltaTime) {
     }
 }
 
-struct MidiToBuffer {
-    Instrument *synth;
-    smf::MidiFile file;
-
-    explicit MidiToBuffer(smf::MidiFile file, Instrument *synth1) : file(std::move(file)) {
-        synth = synth1;
+// the output stream's settings, and how close its callback runs to its deadline, to tune buffer sizes and the lookahead on a given machine
+void AudioEngineStats(AudioPlayer *player) {
+    AudioOutput &output = audioOutput();
+
+    static AudioSettings editing = output.settings;
+    static const char *modes[] = {"Default", "Low latency", "Safe"};
+    int mode = editing.mode;
+    if (ImGui::Combo("Mode", &mode, modes, 3)) {
+        bool realtime = editing.realtime;
+        editing = mode == AudioSettings::LowLatency ? AudioSettings::lowLatency() : mode == AudioSettings::Safe ? AudioSettings::safe() : AudioSettings();
+        editing.device = output.settings.device;
+        editing.realtime = realtime;
     }
-
-    AudioBuffer toSound() {
-        AudioStream stream{};
-
-        file.doTimeAnalysis();
-        file.linkNotePairs();
-        double x = file.getFileDurationInSeconds();
-        if (x < 0) {
-            std::cerr << "Error: File duration is negative" << std::endl;
-            return stream.buffer;
+    std::string deviceName = "Default device";
+    auto devices = AudioOutput::devices();
+    for (const auto &[index, name]: devices) {
+        if (index == editing.device) deviceName = name;
+    }
+    if (ImGui::BeginCombo("Device", deviceName.c_str())) {
+        if (ImGui::Selectable("Default device", editing.device == paNoDevice)) {
+            editing.device = paNoDevice;
         }
-        for (int i = 0; i < file.getTrackCount(); i++) {
-            smf::MidiEventList &track = file[i];
-            for (int j = 0; j < track.size(); j++) {
-                smf::MidiEvent &event = track[j];
-                if (event.isNoteOn()) {
-                    double start = file.getTimeInSeconds(event.tick);
-
-                    double duration = event.getDurationInSeconds();
-
-                    double freq = 440 * std::pow(2, (event.getKeyNumber() - 69) / 12.0);
-                    int velocity = event.getVelocity();
-                    double vol = velocity / 127.0 * 0.5;
-                    AudioBuffer buf = synth->generateSeconds(duration, freq, vol);
-                    stream.write(buf, AudioOffset::fromSeconds(start));
-                }
+        for (const auto &[index, name]: devices) {
+            if (ImGui::Selectable(name.c_str(), editing.device == index)) {
+                editing.device = index;
             }
         }
-        return stream.buffer;
+        ImGui::EndCombo();
     }
+    static const unsigned long bufferSizes[] = {paFramesPerBufferUnspecified, 64, 128, 256, 512, 1024, 2048, 4096};
+    static const char *bufferNames[] = {"Host default", "64", "128", "256", "512", "1024", "2048", "4096"};
+    int buffer = 0;
+    for (int i = 0; i < 8; i++) {
+        if (bufferSizes[i] == editing.framesPerBuffer) buffer = i;
+    }
+    if (ImGui::Combo("Buffer (frames)", &buffer, bufferNames, 8)) {
+        editing.framesPerBuffer = bufferSizes[buffer];
+    }
+    float latency = static_cast<float>(editing.suggestedLatency * 1000.0);
+    if (ImGui::SliderFloat("Suggested latency (ms)", &latency, 0.0f, 200.0f, latency == 0.0f ? "Device default" : "%.1f")) {
+        editing.suggestedLatency = latency / 1000.0;
+    }
+    ImGui::Checkbox("Real time mode", &editing.realtime);
+    if (ImGui::Button("Apply")) {
+        output.open(editing);
+        editing = output.settings;
+    }
+    if (output.settings.realtime) {
+        ImGui::TextWrapped("%s", realtimeStatus().describe().c_str());
+    }
+    ImGui::Separator();
+
+    // every AudioBuffer comes from the pool, a high hit rate means renders are reusing memory instead of allocating it
+    BufferPoolStats pool = bufferPool().snapshot();
+    ImGui::Text("Buffer pool: %zu requests, %.1f%% reused, %zu system allocations", pool.requests, pool.hitRate() * 100.0,
+                pool.systemAllocations);
+    ImGui::Text("Buffer pool: %.1f MB in use, %.1f MB peak, %.1f MB free for reuse", pool.inUse / 1048576.0, pool.peak / 1048576.0,
+                pool.pooled / 1048576.0);
+    if (ImGui::Button("Reset pool stats")) {
+        bufferPool().resetStats();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Trim pool")) {
+        bufferPool().trim();
+    }
+    ImGui::Separator();
 
-    AudioBuffer toSound(double offset, double length) {
-        // offset and length are in seconds
-        AudioStream stream{};
-        file.doTimeAnalysis();
-        file.linkNotePairs();
-        double x = file.getFileDurationInSeconds();
-        if (x < 0) {
-            std::cerr << "Error: File duration is negative" << std::endl;
-            return stream.buffer;
-        }
-        for (int i = 0; i < file.getTrackCount(); i++) {
-            smf::MidiEventList &track = file[i];
-            for (int j = 0; j < track.size(); j++) {
-                smf::MidiEvent &event = track[j];
-                if (event.isNoteOn()) {
-                    double start = file.getTimeInSeconds(event.tick);
-                    if (start < offset) {
-                        continue;
-                    }
-                    if (start > offset + length) {
-                        break;
-                    }
-                    double duration = event.getDurationInSeconds();
-                    double freq = 440 * std::pow(2, (event.getKeyNumber() - 69) / 12.0);
-                    int velocity = event.getVelocity();
-                    double vol = velocity / 127.0 * 0.5;
-                    synth->noteOn(freq, vol);
-                    AudioBuffer buf = synth->generateSeconds(duration, freq, vol);
-                    synth->noteOff(freq);
-                    stream.write(buf, AudioOffset::fromSeconds(start - offset));
-                }
-            }
+    if (!output.isOpen()) {
+        ImGui::Text("The output stream isn't open");
+        return;
+    }
+    const CallbackTiming &timing = output.timing;
+    unsigned long frames = timing.frames.load(std::memory_order_relaxed);
+    double period = timing.periodNanos.load(std::memory_order_relaxed) / 1e6;
+    ImGui::Text("Buffer: %lu frames (%.2f ms) at %.0f Hz", frames, period, output.sampleRate());
+    ImGui::Text("Latency: %.1f ms (input %.1f ms, output %.1f ms)", output.latency() * 1000.0, output.inputLatency() * 1000.0, output.outputLatency() * 1000.0);
+    ImGui::Text("Callback: %.3f ms last, %.3f ms average, %.3f ms max", timing.lastNanos.load(std::memory_order_relaxed) / 1e6,
+                timing.averageNanos() / 1e6, timing.maxNanos.load(std::memory_order_relaxed) / 1e6);
+    ImGui::ProgressBar(static_cast<float>(std::min(timing.load(), 1.0)), ImVec2(-1, 0), "Load");
+    ImGui::Text("Callbacks: %llu, late: %llu", (unsigned long long) timing.callbacks.load(std::memory_order_relaxed),
+                (unsigned long long) timing.late.load(std::memory_order_relaxed));
+    ImGui::Text("Output underflows: %llu, overflows: %llu", (unsigned long long) timing.outputUnderflows.load(std::memory_order_relaxed),
+                (unsigned long long) timing.outputOverflows.load(std::memory_order_relaxed));
+    ImGui::Text("Input underflows: %llu, overflows: %llu", (unsigned long long) timing.inputUnderflows.load(std::memory_order_relaxed),
+                (unsigned long long) timing.inputOverflows.load(std::memory_order_relaxed));
+
+    // the bins are 1/16 of the buffer period wide, everything right of the middle missed the deadline
+    float histogram[CALLBACK_HISTOGRAM_BINS];
+    float highest = 1.0f;
+    for (size_t i = 0; i < CALLBACK_HISTOGRAM_BINS; i++) {
+        histogram[i] = static_cast<float>(timing.histogram[i].load(std::memory_order_relaxed));
+        highest = std::max(highest, histogram[i]);
+    }
+    ImGui::PlotHistogram("##CallbackTimes", histogram, CALLBACK_HISTOGRAM_BINS, 0, "Callback time / buffer period (0 - 2x)", 0.0f, highest, ImVec2(-1, 80));
+    if (ImGui::Button("Reset")) {
+        output.timing.reset();
+    }
+
+    ImGui::Separator();
+    float ceiling = output.limiterCeiling.load(std::memory_order_relaxed);
+    float release = output.limiterRelease.load(std::memory_order_relaxed);
+    bool limiterChanged = ImGui::SliderFloat("Limiter ceiling (dB)", &ceiling, -12.0f, 0.0f, "%.1f");
+    limiterChanged |= ImGui::SliderFloat("Limiter release (ms)", &release, 1.0f, 500.0f, "%.0f");
+    if (limiterChanged) {
+        output.setLimiter(ceiling, release);
+    }
+    float reduction = output.limiterReduction.load(std::memory_order_relaxed);
+    ImGui::Text("Gain reduction: %.1f dB", 20.0f * std::log10(std::max(reduction, 1e-6f)));
+
+    if (player != nullptr) {
+        ImGui::Separator();
+        ImGui::Text("Render underruns: %llu", (unsigned long long) player->underruns());
+        int lookahead = static_cast<int>(player->lookahead());
+        if (ImGui::SliderInt("Lookahead (blocks)", &lookahead, 1, RENDER_AHEAD_MAX_BLOCKS)) {
+            player->setLookahead(lookahead);
         }
-        return stream.buffer;
     }
-};
+}
 
-struct LightDawState {
-    std::unordered_map<uint64_t, LdifFile> instruments{};
-    std::unordered_map<uint64_t, Instrument*> realInstruments{}; // should be one for each instrument
-    std::vector<LdpfFile> patterns{};
-    std::unordered_map<uint64_t, smf::MidiFile> midis{};
+// the project itself (instruments, patterns, midis) and how it is rendered are in ProjectData (see ld/project.h),
+// this adds what only the gui has: the selection, the player and the edits that still have to be re-rendered
+struct LightDawState : public ProjectData {
     size_t selectedPattern = 0;
     size_t selectedInstrument = 0;
 
-    LdipFile project{};
-
     AudioPlayer *player{};
-    AudioStream stream{};
+    // what the player is streaming from, only rebuilt while the player is stopped (single nodes can be replaced while playing)
+    // every pair of the graph is rendered to a stem on renderPool() (see StemNode), they are mixed in pair order
+    // stems are kept in renderCache(), so playing again without changes only has to mix them
+    std::unique_ptr<RenderGraph> graph = std::make_unique<RenderGraph>();
+
+    // what every node of the graph was made from, so edits can find the nodes they invalidate
+    struct GraphPair {
+        uint64_t midi;
+        uint64_t instrument;
+    };
+    std::vector<GraphPair> graphPairs{};
+    std::unordered_map<uint64_t, std::vector<size_t>> instrumentNodes{}; // instrument id -> graph nodes that use it
+    std::unordered_map<uint64_t, std::vector<size_t>> midiNodes{}; // midi id -> graph nodes that use it
+
+    // edits since the graph was built, handled by refreshDirty
+    std::unordered_set<uint64_t> dirtyInstruments{};
+    std::unordered_set<uint64_t> dirtyMidis{};
+    bool dirtyPatterns = false; // pairs were added, removed or changed, the graph has to be rebuilt
 
     std::string filename;
 
-    std::vector<std::string> error_queue; // when an error happens, it will be added to this queue
-    // in the main loop, it will be displayed with a modal popup.
-    // if multiple, they will be displayed in a list, but most of the time it will just be one error.
-
     enum AudioState {
         PLAYING,
         PAUSED,
@@ -257,44 +313,10 @@ struct LightDawState {
         return state;
     }
 
-    uint64_t addInstrument(const LdifFile &instrument) {
-        FileID id = FileID(instrument.toBytes());
-        instruments[id.id] = instrument;
-        return id.id;
-    }
-
     static LightDawState fromArchive(const ArchiveFile &archive, const std::string &filename) {
         LightDawState state;
         state.filename = filename;
-        for (const auto &key: archive.getFileNames()) {
-            if (ends_with(key, ".ldif")) {
-                ByteBuffer buffer = archive.getFile(key).data;
-                LdifFile instrument = LdifFile::fromBytes(buffer);
-                state.instruments[FileID::fromFilename(key).id] = instrument;
-            } else if (ends_with(key, ".ldpf")) {
-                ByteBuffer buffer = archive.getFile(key).data;
-                LdpfFile pattern = LdpfFile::fromBytes(buffer);
-                state.patterns.push_back(pattern);
-            } else if (ends_with(key, ".mid")) {
-                ByteBuffer buffer = archive.getFile(key).data;
-                // midiFile uses a stream, so we need to copy the buffer into a stream
-                std::stringstream stream;
-                for (uint8_t byte: buffer) {
-                    stream << byte;
-                }
-                smf::MidiFile midi;
-                midi.read(stream);
-
-                state.midis[FileID::fromFilename(key).id] = midi;
-            } else if (ends_with(key, ".ldip")) {
-                ByteBuffer buffer = archive.getFile(key).data;
-                state.project = LdipFile::fromBytes(buffer);
-            } else {
-                std::cerr << "Error: Unknown file type: " << key << std::endl;
-                state.error_queue.push_back("Failed to load project:\nUnknown file type: " + key);
-            }
-        }
-        state.createRealInstruments();
+        state.load(archive);
         return state;
     }
 
@@ -313,7 +335,7 @@ struct LightDawState {
 
         for (auto &[id, midi]: midis) {
             std::stringstream ss;
-            midi.write(ss);
+            midi.file.write(ss);
 
             ByteBuffer buffer;
             for (char c: ss.str()) {
@@ -337,113 +359,112 @@ struct LightDawState {
             delete player;
         }
         player = nullptr;
+        graph->clear();
     }
 
-    void createRealInstruments() {
-        for (auto &[id, instrument]: instruments) {
-            if (realInstruments.find(id) == realInstruments.end()) {
-                if (instrument.flags == LdifFile::FLAGS_SYNTH) { // 0x25c2230 sqr  0x25cc9a0 sin
-                    realInstruments[id] = new SynthInstrument(createSynth(instrument.id.id));
-                    if (realInstruments[id] == nullptr) {
-                        std::cerr << "Error: Failed to create synth" << std::endl;
-                        error_queue.emplace_back("Error: Failed to create synth");
-                    } else if (dynamic_cast<SynthInstrument *>(realInstruments[id]) == nullptr) {
-                        std::cerr << "Error: Failed to create synth" << std::endl;
-                        error_queue.emplace_back("Error: Failed to create synth");
-                    } else if (dynamic_cast<SynthInstrument *>(realInstruments[id])->synth == nullptr) {
-                        std::cerr << "Error: Failed to create synth" << std::endl;
-                        error_queue.emplace_back("Error: Failed to create synth");
-                    }
-                    DeserializeResult x = realInstruments[id]->deserializeParams(instrument.instrumentData);
-                    if (x == DeserializeResult::Failure) {
-                        // we assume it's our fault (the data we gave was wrong)
-                        // so we will recreate the synth (to get the default values) and serialize it
-                        // then we will save the new data
-                        std::cerr << "Error: Failed to deserialize synth parameters" << std::endl;
-                        delete realInstruments[id];
-                        realInstruments[id] = new SynthInstrument(createSynth(instrument.id.id));
-                        instrument.instrumentData = realInstruments[id]->serializeParams();
+    // call these when the gui changes something that is rendered
+    void markInstrumentDirty(uint64_t id) {
+        dirtyInstruments.insert(id);
+    }
 
-                    }
-                } else {
-                    std::cerr << "Error: Instrument is not a synth" << std::endl;
-                    error_queue.emplace_back("Error: Instrument is not a synth:\nExternal instruments are not supported in this version!");
-                    // TODO
-                }
-            }
-        }
+    void markMidiDirty(uint64_t id) {
+        dirtyMidis.insert(id);
     }
 
-    void play() {
-        stream.clear();
-        // if pattern mode, play selected pattern, else play all patterns (todo: playlist)
-        if (patternMode) {
-            if (selectedPattern >= patterns.size()) {
-                std::cerr << "Error: Selected pattern out of bounds" << std::endl;
-                error_queue.emplace_back("Error: Selected pattern out of bounds");
-                return;
+    void markPatternsDirty() {
+        dirtyPatterns = true;
+    }
+
+    // re-render only what the edits since the last call invalidated, while playing the stems of those pairs are swapped
+    // into the graph in place, and everything else keeps playing from its stem. when nothing is playing there is nothing to do,
+    // the next play() finds unchanged stems in the cache and renders the rest
+    // don't call this while a widget is being dragged, or every frame of the drag would start a new render
+    void refreshDirty() {
+        if (dirtyInstruments.empty() && dirtyMidis.empty() && !dirtyPatterns) return;
+        if (player != nullptr) {
+            // a deleted instrument or midi changes which pairs can be played, just like a pattern edit
+            bool rebuild = dirtyPatterns;
+            for (uint64_t id : dirtyInstruments) {
+                rebuild |= instrumentNodes.count(id) != 0 && instruments.find(id) == instruments.end();
+            }
+            for (uint64_t id : dirtyMidis) {
+                rebuild |= midiNodes.count(id) != 0 && midis.find(id) == midis.end();
             }
-            LdpfFile pattern = patterns[selectedPattern];
-            for (const auto &[midifileID, instrumentfileID]: pattern.pairs) {
-                if (midis.find(midifileID.id) == midis.end()) {
-                    std::cerr << "Error: Midi file not found" << std::endl;
-                    error_queue.emplace_back("Error: Midi not found!");
-                    continue;
+            if (rebuild) {
+                progress = player->progress();
+                play(audioState == PAUSED);
+            } else {
+                std::set<size_t> stale;
+                for (uint64_t id : dirtyInstruments) {
+                    auto it = instrumentNodes.find(id);
+                    if (it != instrumentNodes.end()) stale.insert(it->second.begin(), it->second.end());
                 }
-                if (instruments.find(instrumentfileID.id) == instruments.end()) {
-                    std::cerr << "Error: Instrument file not found" << std::endl;
-                    error_queue.emplace_back("Error: Instrument not found!");
-                    continue;
+                for (uint64_t id : dirtyMidis) {
+                    auto it = midiNodes.find(id);
+                    if (it != midiNodes.end()) stale.insert(it->second.begin(), it->second.end());
                 }
-                LdifFile instrument = instruments[instrumentfileID.id];
-                if (instrument.flags == LdifFile::FLAGS_SYNTH) {
-                    Synth *synth = createSynth(instrument.id.id);
-
-                    Instrument *instr = realInstruments[instrumentfileID.id];
-                    MidiToBuffer midiToBuffer(midis[midifileID.id], instr);
-                    stream.write(midiToBuffer.toSound());
-                } else {
-                    std::cerr << "Error: Instrument is not a synth" << std::endl;
-                    error_queue.emplace_back("Error: Instrument is not a synth:\nExternal instruments are not supported in this version!");
-                    // TODO
+                for (size_t index : stale) {
+                    graph->replace(index, createStemNode(graphPairs[index].midi, graphPairs[index].instrument));
                 }
             }
-        } else {
-            for (const auto &pattern: patterns) {
-                for (const auto &[midifileID, instrumentfileID]: pattern.pairs) {
-                    if (midis.find(midifileID.id) == midis.end()) {
-                        std::cerr << "Error: Midi file not found" << std::endl;
-                        error_queue.emplace_back("Error: Midi not found!");
-                        continue;
-                    }
-                    if (instruments.find(instrumentfileID.id) == instruments.end()) {
-                        std::cerr << "Error: Instrument file not found" << std::endl;
-                        error_queue.emplace_back("Error: Instrument not found!");
-                        continue;
-                    }
-                    LdifFile instrument = instruments[instrumentfileID.id];
-                    if (instrument.flags == LdifFile::FLAGS_SYNTH) {
-                        Synth *synth = createSynth(instrument.id.id);
+        }
+        dirtyInstruments.clear();
+        dirtyMidis.clear();
+        dirtyPatterns = false;
+    }
 
-                        Instrument *instr = realInstruments[instrumentfileID.id];
-                        MidiToBuffer midiToBuffer(midis[midifileID.id], instr);
-                        stream.write(midiToBuffer.toSound());
-                    } else {
-                        std::cerr << "Error: Instrument is not a synth" << std::endl;
-                        error_queue.emplace_back("Error: Instrument is not a synth:\nExternal instruments are not supported in this version!");
-                        // TODO
-                    }
-                }
-            }
+    // the node for one (midi, instrument) pair, straight from the render cache if nothing about the pair changed since it was last rendered
+    RenderNode* createStemNode(uint64_t midiID, uint64_t instrumentID) {
+        Instrument &instrument = *realInstruments.at(instrumentID); // the pairs come from renderPairs, so both are there
+        StemKey key = stemKey(midiID, instrumentID, instrument);
+        if (Stem stem = renderCache().find(key)) {
+            return new StemNode(stem);
         }
+        return new StemNode(instrument, midis.at(midiID).notes, [key](Stem stem) {
+            renderCache().insert(key, std::move(stem));
+        });
+    }
+
+    void addPair(uint64_t midiID, uint64_t instrumentID) {
+        size_t index = graph->add(createStemNode(midiID, instrumentID));
+        graphPairs.push_back({midiID, instrumentID});
+        instrumentNodes[instrumentID].push_back(index);
+        midiNodes[midiID].push_back(index);
+    }
+
+    // paused builds the graph and the player, but leaves it paused at progress
+    void play(bool paused = false) {
+        // the old player might still be pulling from the graph, so it has to go before we rebuild it
         if (player != nullptr) {
             if (player->isPlaying()) {
                 player->stop();
             }
             delete player;
+            player = nullptr;
         }
-        player = new AudioPlayer(stream.buffer);
+        graph->clear();
+        graphPairs.clear();
+        instrumentNodes.clear();
+        midiNodes.clear();
+        // the graph is built from scratch, so everything that was dirty is included
+        dirtyInstruments.clear();
+        dirtyMidis.clear();
+        dirtyPatterns = false;
+        // if pattern mode, play selected pattern, else play all patterns (todo: playlist)
+        if (patternMode && selectedPattern >= patterns.size()) {
+            std::cerr << "Error: Selected pattern out of bounds" << std::endl;
+            error_queue.emplace_back("Error: Selected pattern out of bounds");
+            return;
+        }
+        for (const auto &[midiID, instrumentID]: renderPairs(patternMode ? selectedPattern : PROJECT_ALL_PATTERNS)) {
+            addPair(midiID, instrumentID);
+        }
+        player = new AudioPlayer(graph.get());
         player->seek(progress);
+        if (paused) {
+            audioState = PAUSED; // resume() starts the stream
+            return;
+        }
         player->play();
         audioState = PLAYING; // TODO: add some prints to the main loop, check where the crash happens
     }
@@ -877,6 +898,7 @@ int main() {
                         if (state.selectedPattern >= state.patterns.size()) {
                             state.selectedPattern = state.patterns.size() - 1;
                         }
+                        state.markPatternsDirty();
                         ImGui::CloseCurrentPopup();
                     }
                     if (ImGui::MenuItem("New")) {
@@ -907,14 +929,15 @@ int main() {
         // make the slider handle itself bigger than the slider bar
         ImGui::PushStyleVar(ImGuiStyleVar_GrabRounding, 5);
         ImGui::PushStyleVar(ImGuiStyleVar_GrabMinSize, 10);
-        ImGui::SliderFloat("##Progress", &state.progress, 0.0f, 1.0f, "");
+        bool seeked = ImGui::SliderFloat("##Progress", &state.progress, 0.0f, 1.0f, "");
         ImGui::PopStyleVar(4);
         ImGui::PopItemWidth();
 
 
 
         // slider calculations
-        if (state.audioState == LightDawState::PLAYING) {
+        // only seek when the slider was moved, re-seeking to the position we just read would make the graph restart every sounding note
+        if (seeked && state.audioState == LightDawState::PLAYING) {
             if (state.player != nullptr) {
                 state.player->seek(state.progress);
             }
@@ -965,6 +988,10 @@ int main() {
             if (instr.second != nullptr) {
                 instr.second->update(deltaTime, 120); // TODO: get bpm from project
                 instr.second->updateGui();
+                if (instr.second->edited) {
+                    instr.second->edited = false;
+                    state.markInstrumentDirty(instr.first);
+                }
             }
 
         } //
@@ -986,7 +1013,7 @@ int main() {
                 for (const auto &[id, instrument]: state.instruments) {
                     if (ImGuiKnobs::Knob(("##Volume"+instrument.name).c_str(), &state.realInstruments[id]->volume, 0.0f, 1.0f,
                                          0.01f, "Volume: %.2f", ImGuiKnobVariant_Wiper, 25, ImGuiKnobFlags_DragHorizontal | ImGuiKnobFlags_NoTitle | ImGuiKnobFlags_NoInput | ImGuiKnobFlags_ValueTooltip, 1000)) {
-                        // volume changed
+                        state.markInstrumentDirty(id);
                     }
                     ImGui::SameLine();
                     if (ImGui::Selectable(instrument.name.c_str(), false, ImGuiSelectableFlags_AllowDoubleClick)) {
@@ -1066,6 +1093,7 @@ int main() {
                     }
                 }
                 state.instruments.erase(oldreplaceID);
+                state.markPatternsDirty();
             }
             state.instruments[newid.id] = newinstrumentfile;
             state.createRealInstruments();
@@ -1092,6 +1120,7 @@ int main() {
             } else {
                 state.instruments.erase(toDelete);
                 state.createRealInstruments();
+                state.markInstrumentDirty(toDelete);
             }
             deleteinstrument = false;
         }
@@ -1101,6 +1130,7 @@ int main() {
             if (ImGui::Button("Yes")) {
                 state.instruments.erase(toDelete);
                 state.createRealInstruments();
+                state.markInstrumentDirty(toDelete);
                 ImGui::CloseCurrentPopup();
             }
             if (ImGui::Button("No")) {
@@ -1216,6 +1246,10 @@ int main() {
                 }
         WINDOW_END()
 
+        WINDOW_START("Audio Engine")
+                AudioEngineStats(state.player);
+        WINDOW_END()
+
         ImGui::ShowDemoWindow();
 
         if (!state.error_queue.empty()) {
@@ -1287,6 +1321,12 @@ int main() {
             ImGui::EndPopup();
         }
 
+        // re-render what was edited this frame, but wait until a drag is let go
+        if (!ImGui::IsAnyItemActive()) {
+            state.refreshDirty();
+        }
+        state.graph->collect();
+
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
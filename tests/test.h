@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+// C++17 basic LightDaw test helpers
+// every test is its own executable (see CMakeLists.txt, ctest runs them all) that returns non-zero when a check failed.
+// a failed check is printed and the test keeps going, so one run shows every failure
+
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            testFailures()++; \
+        } \
+    } while (0)
+
+// |a - b| <= tolerance, prints both values when it isn't
+#define CHECK_NEAR(a, b, tolerance) \
+    do { \
+        double checkA = (a), checkB = (b); \
+        if (!(std::abs(checkA - checkB) <= (tolerance))) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s (%g) is not within %g of %s (%g)\n", __FILE__, __LINE__, #a, checkA, \
+                         static_cast<double>(tolerance), #b, checkB); \
+            testFailures()++; \
+        } \
+    } while (0)
+
+// what main returns
+inline int testResult(const char* name) {
+    if (testFailures() > 0) {
+        std::fprintf(stderr, "%s: %d checks failed\n", name, testFailures());
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
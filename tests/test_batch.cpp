@@ -0,0 +1,75 @@
+#include "ld/batch.h"
+#include "tests/test.h"
+
+// the memory a job is admitted with (estimateJobBytes) has to stay an upper bound: a stem that was in the cache when the job
+// was estimated is pinned, so another job pushing it out of the cache doesn't make this one render it outside its lease
+
+#define BATCH_PAIRS 4
+
+ProjectData makeProject() {
+    ProjectData data;
+    LdifFile file("Sine", LdifFile::FLAGS_SYNTH, FileID(SineSynth::id));
+    file.instrumentData = SynthInstrument(new SineSynth()).serializeParams();
+    uint64_t sine = data.addInstrument(file);
+    data.createRealInstruments();
+    std::vector<LdpfFile::Pair> pairs;
+    for (size_t i = 0; i < BATCH_PAIRS; i++) {
+        NoteTable notes;
+        for (size_t j = 0; j < 20; j++) {
+            notes.add((j * 2 + i) * SAMPLE_RATE / 4, SAMPLE_RATE / 8, static_cast<uint8_t>(48 + i * 5 + j % 7), 100);
+        }
+        notes.sort();
+        MidiClip clip;
+        clip.notes = std::make_shared<const NoteTable>(std::move(notes));
+        data.midis[100 + i] = clip;
+        FileID midi;
+        midi.id = 100 + i;
+        FileID instrument;
+        instrument.id = sine;
+        pairs.push_back({midi, instrument});
+    }
+    data.patterns.emplace_back("pattern", pairs);
+    return data;
+}
+
+int main() {
+    ProjectData data = makeProject();
+    std::vector<std::pair<uint64_t, uint64_t>> pairs = data.renderPairs(PROJECT_ALL_PATTERNS);
+    RenderJob job;
+    ThreadPool pool(2);
+    RenderCache cache;
+
+    std::vector<Stem> pinned;
+    size_t uncached = estimateJobBytes(data, pairs, job, &cache, pinned);
+    CHECK(pinned.size() == BATCH_PAIRS);
+    for (const Stem& stem : pinned) {
+        CHECK(stem == nullptr);
+    }
+    OfflineRenderStats first;
+    AudioStream reference = renderOffline(data, pairs, job.options, first, pool, &cache, pinned);
+    CHECK(first.cachedStems == 0);
+    CHECK(cache.size() == BATCH_PAIRS);
+
+    // cached stems count with what they really take up, which is less than the worst case
+    size_t cached = estimateJobBytes(data, pairs, job, &cache, pinned);
+    CHECK(cached < uncached);
+    size_t pinnedBytes = 0;
+    for (const Stem& stem : pinned) {
+        CHECK(stem != nullptr);
+        if (stem != nullptr) pinnedBytes += stem->bytes();
+    }
+    CHECK(pinnedBytes > 0);
+
+    // another job fills the cache with its own stems before this one renders
+    cache.clear();
+    OfflineRenderStats second;
+    AudioStream stream = renderOffline(data, pairs, job.options, second, pool, &cache, pinned);
+    CHECK(second.cachedStems == BATCH_PAIRS); // nothing was rendered again
+    CHECK(stream.size() == reference.size());
+    bool same = stream.size() == reference.size();
+    for (size_t i = 0; same && i < stream.size(); i++) {
+        same = stream.buffer[i] == reference.buffer[i];
+    }
+    CHECK(same);
+    return testResult("batch");
+}
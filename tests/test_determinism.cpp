@@ -0,0 +1,117 @@
+#include "ld/project.h"
+#include "tests/test.h"
+
+// stems and offline renders have to come out the same, sample for sample, no matter how many threads the pool has
+// or which stem finishes first. every pair renders on its own copy of the instrument and the graph and the mix
+// sum the pairs in pair order, so one thread and many threads give bit identical output
+
+#define DETERMINISM_PAIRS 12
+#define DETERMINISM_THREADS 8
+
+NoteTableRef makeNotes(size_t pair) {
+    NoteTable notes;
+    for (size_t i = 0; i < 40; i++) {
+        // overlapping notes, so voices are stolen and released
+        notes.add((i * 3 + pair) * SAMPLE_RATE / 8, SAMPLE_RATE / 3 + pair * 101, static_cast<uint8_t>(36 + (pair * 7 + i * 5) % 60), static_cast<uint8_t>(40 + i % 80));
+    }
+    notes.sort();
+    return std::make_shared<const NoteTable>(std::move(notes));
+}
+
+std::unique_ptr<Instrument> makeInstrument(size_t pair) {
+    if (pair % 5 == 4) {
+        return std::make_unique<SynthInstrument>(new SineSynth());
+    }
+    auto* synth = new EnvelopeSynth();
+    synth->waveType = static_cast<Waveform>(pair % 4);
+    return std::make_unique<SynthInstrument>(synth);
+}
+
+// the whole stem as plain samples
+std::vector<float> stemSamples(const Stem& stem) {
+    std::vector<float> samples(stem->size(), 0.0f);
+    stem->mixInto(samples.data(), 0, samples.size());
+    return samples;
+}
+
+// the pairs rendered by StemNodes on a pool of `threads` threads
+std::vector<std::vector<float>> renderNodes(const std::vector<std::unique_ptr<Instrument>>& instruments, const std::vector<NoteTableRef>& notes, size_t threads) {
+    ThreadPool pool(threads);
+    std::vector<std::unique_ptr<StemNode>> nodes;
+    for (size_t i = 0; i < instruments.size(); i++) {
+        nodes.push_back(std::make_unique<StemNode>(*instruments[i], notes[i], nullptr, pool));
+    }
+    pool.wait();
+    std::vector<std::vector<float>> stems;
+    for (const auto& node : nodes) {
+        CHECK(node->ready());
+        stems.push_back(node->ready() ? stemSamples(node->job->stem) : std::vector<float>());
+    }
+    return stems;
+}
+
+// an instrument of the project with the parameters of `instrument`
+uint64_t addSynth(ProjectData& data, const std::string& name, uint64_t id, Instrument& instrument) {
+    LdifFile file(name, LdifFile::FLAGS_SYNTH, FileID(id));
+    file.instrumentData = instrument.serializeParams();
+    return data.addInstrument(file);
+}
+
+// a project with the same pairs, rendered offline on a pool of `threads` threads
+std::vector<float> renderProject(size_t threads) {
+    ProjectData data;
+    uint64_t sine = addSynth(data, "Sine", SineSynth::id, *makeInstrument(4));
+    uint64_t saw = addSynth(data, "Saw", EnvelopeSynth::id, *makeInstrument(3));
+    data.createRealInstruments();
+    std::vector<LdpfFile::Pair> pairs;
+    for (size_t i = 0; i < DETERMINISM_PAIRS; i++) {
+        MidiClip clip;
+        clip.notes = makeNotes(i);
+        data.midis[100 + i] = clip;
+        FileID midi;
+        midi.id = 100 + i;
+        FileID instrument;
+        instrument.id = i % 5 == 4 ? sine : saw;
+        pairs.push_back({midi, instrument});
+    }
+    data.patterns.emplace_back("pattern", pairs);
+
+    OfflineRenderOptions options;
+    OfflineRenderStats stats;
+    ThreadPool pool(threads);
+    AudioStream stream = renderOffline(data, data.renderPairs(options.pattern), options, stats, pool);
+    std::vector<float> samples(stream.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = stream.buffer[i];
+    }
+    return samples;
+}
+
+int main() {
+    std::vector<std::unique_ptr<Instrument>> instruments;
+    std::vector<NoteTableRef> notes;
+    std::vector<std::vector<float>> serial;
+    for (size_t i = 0; i < DETERMINISM_PAIRS; i++) {
+        instruments.push_back(makeInstrument(i));
+        notes.push_back(makeNotes(i));
+        std::unique_ptr<Instrument> copy(instruments.back()->clone());
+        serial.push_back(stemSamples(std::make_shared<const RenderedStem>(renderStem(copy.get(), notes.back()))));
+    }
+
+    // a few rounds, so the stems finish in different orders
+    for (size_t round = 0; round < 3; round++) {
+        std::vector<std::vector<float>> one = renderNodes(instruments, notes, 1);
+        std::vector<std::vector<float>> many = renderNodes(instruments, notes, DETERMINISM_THREADS);
+        for (size_t i = 0; i < DETERMINISM_PAIRS; i++) {
+            CHECK(one[i] == serial[i]);
+            CHECK(many[i] == serial[i]);
+        }
+    }
+
+    std::vector<float> one = renderProject(1);
+    CHECK(!one.empty());
+    for (size_t round = 0; round < 3; round++) {
+        CHECK(renderProject(DETERMINISM_THREADS) == one);
+    }
+    return testResult("determinism");
+}
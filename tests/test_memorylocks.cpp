@@ -0,0 +1,55 @@
+#include "ld/realtime.h"
+#include "tests/test.h"
+#include <memory>
+
+// lockMemory/unlockMemory count the locks on every page: unlocking one object must not unlock a page another locked object
+// is on. checked with the page counts and, where the system allows locking, with what it says is locked (VmLck)
+
+int main() {
+    size_t page = MemoryLocks::pageSize();
+    std::unique_ptr<unsigned char[]> storage(new unsigned char[5 * page]()); // four whole pages in it
+    unsigned char* memory = storage.get() + (page - reinterpret_cast<uintptr_t>(storage.get()) % page) % page;
+    MemoryLocks& locks = memoryLocks();
+    size_t before = processLockedMemory();
+
+    // a and b share the second page
+    bool lockedA = lockMemory(memory + 10, page + 10);
+    bool lockedB = lockMemory(memory + page + 100, page);
+    bool system = lockedA && lockedB && before + 3 * page == processLockedMemory(); // root or a big enough RLIMIT_MEMLOCK
+    std::printf("locking is %s\n", system ? "allowed, checking VmLck too" : "not allowed, only checking the counts");
+    CHECK(locks.pages.size() == 3);
+    CHECK(locks.pages[reinterpret_cast<uintptr_t>(memory + page)] == 2);
+
+    unlockMemory(memory + 10, page + 10);
+    CHECK(locks.pages.size() == 2); // the shared page stays
+    CHECK(locks.pages.count(reinterpret_cast<uintptr_t>(memory + page)) == 1);
+    if (system) CHECK(processLockedMemory() == before + 2 * page);
+
+    unlockMemory(memory + page + 100, page);
+    CHECK(locks.pages.empty());
+    if (system) CHECK(processLockedMemory() == before);
+    CHECK(realtimeStatus().lockedBytes.load() == 0);
+
+    // unlocking something that was never locked changes nothing
+    unlockMemory(memory, 4 * page);
+    CHECK(locks.pages.empty());
+
+    // everything locked, then back to the one object that still holds its lock
+    if (lockAllMemory()) {
+        CHECK(realtimeStatus().lockAll.load() == RealtimeResult::Done);
+        lockMemory(memory, page);
+        lockMemory(memory + 2 * page, page);
+        unlockMemory(memory + 2 * page, page); // stays locked, everything is
+        CHECK(processLockedMemory() >= realtimeStatus().processLockedBytes.load());
+        unlockAllMemory();
+        CHECK(realtimeStatus().lockAll.load() == RealtimeResult::Off);
+        CHECK(processLockedMemory() == before + page); // only the page that is still locked by itself
+        unlockMemory(memory, page);
+        CHECK(processLockedMemory() == before);
+    } else {
+        std::printf("mlockall is not allowed, skipped\n");
+        CHECK(realtimeStatus().lockAll.load() == RealtimeResult::Failed);
+    }
+    CHECK(locks.pages.empty());
+    return testResult("memorylocks");
+}
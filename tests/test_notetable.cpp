@@ -0,0 +1,76 @@
+#include "ld/notetable.h"
+#include "tests/test.h"
+#include <set>
+
+// NoteTable::forEachOverlapping against a scan of every note, and the work it does: one drone over the whole song
+// must not make the query look at the notes that are already over
+
+#define TABLE_NOTES 20000
+#define NOTE_SPACING 1000
+
+std::set<size_t> scan(const NoteTable& table, size_t from, size_t to) {
+    std::set<size_t> found;
+    for (size_t i = 0; i < table.size(); i++) {
+        bool sounds = from == to ? table.start[i] < from && table.end(i) > from : table.start[i] < to && table.end(i) > from;
+        if (table.length[i] > 0 && sounds) found.insert(i);
+    }
+    return found;
+}
+
+// checks the notes found in [from, to) and that at most one extra note per tree level was looked at
+void check(const NoteTable& table, size_t from, size_t to, size_t levels) {
+    std::set<size_t> found;
+    size_t calls = 0;
+    size_t visited = table.forEachOverlapping(from, to, [&](size_t index) {
+        found.insert(index);
+        calls++;
+    });
+    CHECK(calls == found.size()); // every note once
+    CHECK(found == scan(table, from, to));
+    CHECK(visited <= found.size() + 2 * levels);
+}
+
+int main() {
+    NoteTable table;
+    table.add(0, TABLE_NOTES * NOTE_SPACING, 36, 100); // the drone
+    for (size_t i = 0; i < TABLE_NOTES; i++) {
+        // short notes, some overlapping the next few, and a few without length
+        table.add(i * NOTE_SPACING + i % 7, i % 13 == 0 ? 0 : NOTE_SPACING / 2 + (i % 5) * NOTE_SPACING, static_cast<uint8_t>(40 + i % 40), 90);
+    }
+    table.add(TABLE_NOTES * NOTE_SPACING / 2, 1, 60, 100); // a one sample note in the middle
+    table.sort();
+
+    size_t levels = 0;
+    for (size_t n = table.size(); n > 0; n /= 2) {
+        levels++;
+    }
+    levels++;
+    size_t lastEnd = 0;
+    size_t maxOverlap = 0;
+    for (size_t i = 0; i < table.size(); i++) {
+        lastEnd = std::max(lastEnd, table.end(i));
+        maxOverlap = std::max(maxOverlap, scan(table, table.start[i], table.start[i] + 1).size());
+    }
+    CHECK(table.duration() == lastEnd);
+    CHECK(table.maxOverlap == maxOverlap);
+
+    const size_t positions[] = {0, 1, 999, 1000, 1500, 123456, TABLE_NOTES * NOTE_SPACING / 2, TABLE_NOTES * NOTE_SPACING / 2 + 1,
+                                TABLE_NOTES * NOTE_SPACING - 1, TABLE_NOTES * NOTE_SPACING, TABLE_NOTES * NOTE_SPACING * 2};
+    for (size_t position : positions) {
+        check(table, position, position, levels); // a seek
+        check(table, position, position + 1, levels);
+        check(table, position, position + 4096, levels); // a block
+        check(table, position, position + 200000, levels); // a region
+    }
+
+    // the seek the old prefix maximum made slow: the drone kept every earlier note in the range
+    size_t visited = table.forEachOverlapping(TABLE_NOTES * NOTE_SPACING - 10, TABLE_NOTES * NOTE_SPACING - 10, [](size_t) {});
+    std::printf("a seek to the end looked at %zu of %zu notes\n", visited, table.size());
+    CHECK(visited < 100);
+
+    NoteTable empty;
+    empty.sort();
+    CHECK(empty.forEachOverlapping(0, 100, [](size_t) {}) == 0);
+    CHECK(empty.duration() == 0);
+    return testResult("notetable");
+}
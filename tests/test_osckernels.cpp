@@ -0,0 +1,87 @@
+#include "ld/osckernels.h"
+#include "ld/oscillator.h"
+#include "tests/test.h"
+#include <algorithm>
+#include <vector>
+
+// every kernel the cpu has (see simdLevel) against the scalar one, at several frequencies, phases, gain ramps and frame counts,
+// the odd counts go through the scalar tails of the vector kernels. they have to agree within OSC_KERNEL_TOLERANCE per unit of gain
+
+const char* levelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX512:
+            return "AVX-512";
+        case SimdLevel::AVX2:
+            return "AVX2";
+        case SimdLevel::SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
+
+// the largest difference to the scalar kernel per unit of gain, over every case
+float compare(Waveform wave, SimdLevel level) {
+    const double frequencies[] = {27.5, 440.0, 3520.0, 12000.0, 21000.0};
+    const float phases[] = {0.0f, 0.125f, 0.5f, 0.9999f};
+    const size_t frameCounts[] = {1, 3, 7, 8, 15, 17, 31, 33, 63, OSC_CHUNK};
+    const float ramps[][2] = {{1.0f, 0.0f}, {0.0f, 1.0f / OSC_CHUNK}, {0.8f, -0.01f}}; // gain, step
+    OscKernel scalar = oscKernelFor<Waveform::Sine>(SimdLevel::Scalar);
+    switch (wave) {
+        case Waveform::Triangle:
+            scalar = oscKernelFor<Waveform::Triangle>(SimdLevel::Scalar);
+            break;
+        case Waveform::Square:
+            scalar = oscKernelFor<Waveform::Square>(SimdLevel::Scalar);
+            break;
+        case Waveform::Saw:
+            scalar = oscKernelFor<Waveform::Saw>(SimdLevel::Scalar);
+            break;
+        default:
+            break;
+    }
+    OscKernel kernel = oscKernel(wave, level);
+    float worst = 0.0f;
+    std::vector<float> expected(OSC_CHUNK + 1);
+    std::vector<float> actual(OSC_CHUNK + 1);
+    for (double frequency : frequencies) {
+        auto inc = static_cast<float>(frequency / 44100.0);
+        for (float phase : phases) {
+            for (size_t frames : frameCounts) {
+                for (const auto& ramp : ramps) {
+                    for (size_t offset = 0; offset < 2; offset++) { // aligned and unaligned output
+                        std::fill(expected.begin(), expected.end(), 0.25f); // the kernels add
+                        std::fill(actual.begin(), actual.end(), 0.25f);
+                        scalar(expected.data() + offset, frames, phase, inc, ramp[0], ramp[1]);
+                        kernel(actual.data() + offset, frames, phase, inc, ramp[0], ramp[1]);
+                        float gain = std::max(std::abs(ramp[0]), std::abs(ramp[0] + ramp[1] * static_cast<float>(frames)));
+                        for (size_t i = 0; i < expected.size(); i++) {
+                            float error = std::abs(actual[i] - expected[i]) / std::max(gain, 1e-3f);
+                            worst = std::max(worst, error);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return worst;
+}
+
+int main() {
+    const Waveform waves[] = {Waveform::Sine, Waveform::Triangle, Waveform::Square, Waveform::Saw};
+    const char* waveNames[] = {"sine", "triangle", "square", "saw"};
+    const SimdLevel levels[] = {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512};
+    SimdLevel detected = simdLevel();
+    for (SimdLevel level : levels) {
+        if (level > detected) {
+            std::printf("%s: not on this cpu, skipped\n", levelName(level));
+            continue;
+        }
+        for (size_t w = 0; w < 4; w++) {
+            float worst = compare(waves[w], level);
+            std::printf("%s %s: largest difference %g\n", levelName(level), waveNames[w], worst);
+            CHECK(worst <= OSC_KERNEL_TOLERANCE);
+        }
+    }
+    return testResult("osckernels");
+}
@@ -0,0 +1,95 @@
+#include "ld/render.h"
+#include "tests/test.h"
+#include <thread>
+
+// RenderGraph::replace and collect while another thread keeps rendering the graph, like the ui thread swapping stems
+// while the render worker plays. every node adds 1 to the block, so a block always sums to the number of slots whatever
+// was swapped in, and a node that was already deleted would be caught by its magic (or by asan/tsan, build with them)
+
+#define GRAPH_SLOTS 8
+#define GRAPH_REPLACES 20000
+#define GRAPH_BLOCK 64
+#define NODE_ALIVE 0x11DEAD11u
+#define NODE_DELETED 0xDE1E7EDu
+
+std::atomic<size_t> nodesCreated{0};
+std::atomic<size_t> nodesDeleted{0};
+std::atomic<size_t> deadRenders{0};
+
+struct CountingNode : public RenderNode {
+    volatile uint32_t magic = NODE_ALIVE;
+
+    CountingNode() {
+        nodesCreated++;
+    }
+
+    ~CountingNode() override {
+        magic = NODE_DELETED;
+        nodesDeleted++;
+    }
+
+    void render(float* out, size_t, size_t frames) override {
+        if (magic != NODE_ALIVE) deadRenders++;
+        for (size_t i = 0; i < frames; i++) {
+            out[i] += 1.0f;
+        }
+    }
+
+    [[nodiscard]] size_t length() const override {
+        return SIZE_MAX;
+    }
+};
+
+int main() {
+    {
+        RenderGraph graph;
+        for (size_t i = 0; i < GRAPH_SLOTS; i++) {
+            graph.add(new CountingNode());
+        }
+
+        std::atomic<bool> stop{false};
+        size_t blocks = 0;
+        size_t wrongBlocks = 0;
+        std::thread worker([&] {
+            std::vector<float> block(GRAPH_BLOCK);
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::fill(block.begin(), block.end(), 0.0f);
+                graph.render(block.data(), blocks * GRAPH_BLOCK, GRAPH_BLOCK);
+                for (float sample : block) {
+                    if (sample != GRAPH_SLOTS) {
+                        wrongBlocks++;
+                        break;
+                    }
+                }
+                blocks++;
+            }
+        });
+
+        size_t maxRetired = 0;
+        for (size_t i = 0; i < GRAPH_REPLACES; i++) {
+            graph.replace((i * 7) % GRAPH_SLOTS, new CountingNode());
+            if (i % 16 == 0) {
+                graph.collect();
+                std::this_thread::yield();
+            }
+            maxRetired = std::max(maxRetired, graph.retired.size());
+        }
+        // the worker keeps going, so every node that was replaced can be collected
+        uint64_t renders = graph.renders.load();
+        while (graph.renders.load() < renders + 2) {
+            std::this_thread::yield();
+        }
+        graph.collect();
+        CHECK(graph.retired.empty());
+        stop.store(true);
+        worker.join();
+
+        std::printf("%zu blocks, %zu replaces, at most %zu nodes waiting to be deleted\n", blocks, static_cast<size_t>(GRAPH_REPLACES), maxRetired);
+        CHECK(blocks > 0);
+        CHECK(wrongBlocks == 0);
+        CHECK(deadRenders.load() == 0);
+        CHECK(nodesDeleted.load() == GRAPH_REPLACES); // every replaced node, the live ones are still in the graph
+    }
+    CHECK(nodesDeleted.load() == nodesCreated.load());
+    return testResult("rendergraph");
+}
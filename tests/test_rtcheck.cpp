@@ -0,0 +1,180 @@
+#include "ld/render.h"
+#include "tests/test.h"
+#include <thread>
+
+// built with LD_RT_CHECK (see CMakeLists.txt), so allocations, frees and mutex locks are counted (see ld/rtcheck.h).
+// every component the audio callback and the render worker run is played for a while inside a RealtimeScope, from its
+// first block on, with notes starting, overlapping and ending, and must not do any of those
+
+#define RT_BLOCKS 256 // ~3 s of RENDER_BLOCK_SIZE blocks
+
+volatile float* rtSink = nullptr; // so the allocation in the sanity check can't be optimized away
+
+NoteTableRef makeNotes() {
+    NoteTable notes;
+    for (size_t i = 0; i < 200; i++) {
+        // more notes at once than the node has voices, so voices are stolen too
+        notes.add(i * RENDER_BLOCK_SIZE / 2, RENDER_BLOCK_SIZE * (1 + i % 40), static_cast<uint8_t>(30 + i % 70), static_cast<uint8_t>(20 + i % 100));
+    }
+    notes.sort();
+    return std::make_shared<const NoteTable>(std::move(notes));
+}
+
+std::unique_ptr<Instrument> makeInstrument() {
+    auto* synth = new EnvelopeSynth();
+    synth->waveType = Waveform::Saw;
+    return std::make_unique<SynthInstrument>(synth);
+}
+
+// renders RT_BLOCKS blocks of the node inside a scope, returns what it did wrong
+size_t renderBlocks(const char* name, RenderNode& node) {
+    std::vector<float> block(RENDER_BLOCK_SIZE);
+    RealtimeScope scope(name);
+    for (size_t i = 0; i < RT_BLOCKS; i++) {
+        std::fill(block.begin(), block.end(), 0.0f);
+        node.render(block.data(), i * RENDER_BLOCK_SIZE, RENDER_BLOCK_SIZE);
+    }
+    return scope.counts().total();
+}
+
+int main() {
+#ifndef LD_RT_CHECK
+    std::printf("rtcheck: built without LD_RT_CHECK, nothing is checked\n");
+    return 0;
+#else
+    // the checker itself has to see an allocation, or every other check passes for nothing
+    {
+        rtCheckPrint.store(false);
+        RealtimeScope scope("sanity");
+        auto* allocated = new float[64]; // operator new is caught everywhere, malloc only on glibc
+        rtSink = allocated;
+        delete[] allocated;
+        CHECK(scope.counts().allocations >= 1);
+        CHECK(scope.counts().frees >= 1);
+        rtCheckPrint.store(true);
+    }
+    size_t violations = rtCheckViolations.load();
+
+    NoteTableRef notes = makeNotes();
+    std::unique_ptr<Instrument> instrument = makeInstrument();
+
+    {
+        NoteSequenceNode node(instrument.get(), notes, 16);
+        CHECK(renderBlocks("NoteSequenceNode", node) == 0);
+        // jumping around (looping, moving the playhead) seeks, which finds the sounding notes again
+        std::vector<float> block(RENDER_BLOCK_SIZE);
+        RealtimeScope scope("NoteSequenceNode seek");
+        for (size_t i = 0; i < RT_BLOCKS; i++) {
+            node.render(block.data(), (i * 7919) % (RT_BLOCKS * RENDER_BLOCK_SIZE), RENDER_BLOCK_SIZE);
+        }
+        CHECK(scope.counts().total() == 0);
+    }
+
+    ThreadPool pool(2);
+    {
+        StemNode node(*instrument, notes, nullptr, pool);
+        pool.wait();
+        CHECK(node.ready());
+        CHECK(renderBlocks("StemNode", node) == 0);
+    }
+
+    // a pool that doesn't get to the stems until it is released, so their nodes play the notes live
+    ThreadPool blocked(1);
+    std::atomic<bool> release{false};
+    blocked.submit([&release] {
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+    {
+        StemNode node(*instrument, notes, nullptr, blocked);
+        CHECK(!node.ready());
+        CHECK(renderBlocks("StemNode live", node) == 0);
+    }
+
+    std::unique_ptr<Instrument> liveInstrument(instrument->clone());
+    {
+        RenderGraph graph;
+        graph.add(new NoteSequenceNode(liveInstrument.get(), notes, 16));
+        graph.add(new StemNode(*instrument, notes, nullptr, pool));
+        pool.wait();
+        graph.add(new StemNode(*instrument, notes, nullptr, blocked));
+        CHECK(renderBlocks("RenderGraph", graph) == 0);
+    }
+    release.store(true);
+    blocked.wait();
+
+    {
+        Limiter limiter(SAMPLE_RATE);
+        std::vector<float> block(RENDER_BLOCK_SIZE);
+        RealtimeScope scope("Limiter");
+        for (size_t i = 0; i < RT_BLOCKS; i++) {
+            for (size_t j = 0; j < RENDER_BLOCK_SIZE; j++) {
+                block[j] = (j % 7 < 3 ? 3.0f : -2.0f) * static_cast<float>(i % 4); // loud, and silent every fourth block
+            }
+            limiter.process(block.data(), block.size());
+            if (i == RT_BLOCKS / 2) {
+                limiter.setCeiling(-6.0f);
+                limiter.setRelease(200.0f);
+            }
+        }
+        CHECK(scope.counts().total() == 0);
+    }
+
+    // the ui starts more previews than there are voices, the callback steals the oldest ones
+    auto triggerPreviews = [](PreviewBus& bus, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            bus.trigger(SAMPLE_RATE / 4 + i * 100, [i](float* out) {
+                for (size_t j = 0; j < SAMPLE_RATE / 4; j++) {
+                    out[j] = static_cast<float>((j + i) % 50) / 100.0f;
+                }
+            });
+        }
+    };
+
+    {
+        PreviewBus bus;
+        triggerPreviews(bus, PREVIEW_VOICES + 4);
+        std::vector<float> block(AUDIO_CHUNK_SIZE);
+        RealtimeScope scope("PreviewBus");
+        for (size_t i = 0; i < RT_BLOCKS; i++) {
+            bus.process(block.data(), block.size());
+        }
+        CHECK(scope.counts().total() == 0);
+    }
+
+    {
+        // pressing keys (a second each, see Instrument::playMidi) reuses the buffers of the slots, so the ui doesn't allocate either
+        PreviewBus bus;
+        std::vector<float> block(AUDIO_CHUNK_SIZE);
+        RealtimeScope scope("PreviewBus trigger");
+        for (size_t i = 0; i < 4 * PREVIEW_SLOTS; i++) {
+            bus.trigger(PREVIEW_FRAMES, [](float* out) {
+                out[0] = 1.0f;
+            });
+            bus.process(block.data(), block.size());
+        }
+        CHECK(scope.counts().total() == 0);
+    }
+
+    {
+        // the callback body, called the way PortAudio would but without a stream
+        AudioOutput output;
+        PreviewBus bus;
+        output.sources[0].store(&bus);
+        triggerPreviews(bus, PREVIEW_VOICES + 4);
+        output.limiterCeiling.store(-3.0f); // picked up inside the callback
+        output.limiterRelease.store(100.0f);
+        std::vector<float> buffer(AUDIO_CHUNK_SIZE * 3 + 17);
+        RealtimeScope scope("AudioOutput::callback");
+        for (size_t i = 0; i < RT_BLOCKS; i++) {
+            AudioOutput::callback(nullptr, buffer.data(), buffer.size(), nullptr, 0, &output);
+        }
+        CHECK(scope.counts().total() == 0);
+        output.sources[0].store(nullptr);
+    }
+
+    CHECK(rtCheckViolations.load() == violations);
+    return testResult("rtcheck");
+#endif
+}